@@ -1,7 +1,18 @@
 #include "apu.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 APU::APU(std::shared_ptr<Mem> memory) {
 	this->memory = memory;
+	synth_mix_tables(AUDIO_VOLUME, pulse_mix.data(), tnd_mix.data());
+}
+
+APU::~APU() {
+	//The callback reads the ring, so the device has to stop before the ring goes.
+	if (device != 0) {
+		SDL_CloseAudioDevice(device);
+	}
 }
 
 
@@ -49,7 +60,8 @@ void APU::status_reg_changes() {
 
 	else {
 		if (dmc_bytes_remaining == 0) {
-			dmc_restart = true;		
+			dmc_restart();
+			dmc_fetch();
 		}	
 	}
 
@@ -95,6 +107,30 @@ void APU::frame_counter_changes() {
 }
 
 void APU::reg_write(uint64_t index, uint8_t value) {
+       sync();
+
+       //Channels the write can affect are brought up to now before it, and rescheduled after.
+       uint8_t first = 0, last = NUM_CHANNELS - 1;
+       if (IS_PULSE_REG(index)) {
+	    first = last = CHANNEL_PULSE1 + (index - 0x4000) / 4;
+       }
+
+       else if (IS_TRIANGLE_REG(index)) {
+	    first = last = CHANNEL_TRIANGLE;
+       }
+
+       else if (IS_NOISE_REG(index)) {
+	    first = last = CHANNEL_NOISE;
+       }
+
+       else if (IS_DMC_REG(index)) {
+	    first = last = CHANNEL_DMC;
+       }
+
+       for (uint8_t channel = first; channel <= last; channel++) {
+	    advance_channel(channel, apu_time);
+       }
+
        if (IS_PULSE_REG(index)) {
 	    uint8_t wave_num = (index - 0x4000) / 4;
 	    pulse_regs[wave_num][index % 4] = value;
@@ -146,11 +182,17 @@ void APU::reg_write(uint64_t index, uint8_t value) {
 	    frame_counter = value;
 	    frame_counter_changes();
        }
-       	
+
+       for (uint8_t channel = first; channel <= last; channel++) {
+	    update_channel(channel);
+       }
+       output_changed(apu_time);
 }
 
 
 uint8_t APU::reg_read(uint64_t index) {
+       sync();
+
        if (IS_PULSE_REG(index)) {
 	    return pulse_regs[(index - 0x4000) / 4][index % 4];
        }
@@ -201,36 +243,12 @@ uint8_t APU::reg_read(uint64_t index) {
 
 
 
-uint8_t APU::mix_waves() {
-//This calculates the audio signal per APU cycle. The analog signal is calculated based off of the channel signals and ranges from 0 - 1.
-//The digital signal is proportional to the analog signal, and right now it is 1 byte. If you want to change the resolution level, change the proportionate factor it is multiplied by.
-	uint8_t digital_output;
-	double analog_output;
-	double pulse_out, tnd_out;
-	double pulse_wave_sum = pulse_signals[0] + pulse_signals[1];
-	double tnd_sum = 3 * triangle_signal + 2 * noise_signal + dmc_signal;
-
-	if (pulse_wave_sum == 0) {
-		pulse_out = 0;
-	}
-
-	else {
-		 pulse_out = 95.52 / ( (8128.0 / pulse_wave_sum) + 100);
-	}
-
-	if (tnd_sum == 0) {
-		 tnd_out = 0;	
-	}	
-
-	else {
- 		 tnd_out = 163.67 / ((24329.0 / tnd_sum) + 100);
-	}
-
-
-	analog_output = tnd_sum + pulse_wave_sum;
-	digital_output = (uint8_t) (256 * analog_output);
-
-	return digital_output; 
+int16_t APU::mix_waves() {
+//This calculates the audio signal from the channel signals. The DAC is nonlinear, so its output for every
+//pulse sum and every triangle/noise/DMC sum is worked out once, scaled by AUDIO_VOLUME, in the constructor.
+	uint8_t pulse_wave_sum = pulse_signals[0] + pulse_signals[1];
+	uint8_t tnd_sum = 3 * triangle_signal + 2 * noise_signal + dmc_signal;
+	return pulse_mix[pulse_wave_sum] + tnd_mix[tnd_sum];
 }
 
 void APU::clock_linear_counter() {
@@ -314,169 +332,281 @@ void APU::clock_sweep(struct Sweep& sweep, uint8_t& info_reg) {
 	}
 }
 
-void APU::pulse_update(uint8_t index) {
-//Index indicates which pulse wave is being updated.
-	uint8_t const_vol = (pulse_regs[index][0] >> 4) % 2;
-	uint8_t length_counter_halt = (pulse_regs[index][0] >> 4) & 0x1;
+void APU::pulse_advance(uint8_t index, uint64_t time) {
+//Moves the duty sequence on by however many timer periods have ended by time. The timer counts 2 * (period + 1) CPU cycles per step.
+	if (time < pulse_next_step[index]) {
+		return;
+	}
+
 	uint16_t timer_period = pulse_regs[index][2] + ((pulse_regs[index][3] % 8) << 8);
-	uint8_t duty_index = (pulse_regs[index][0] >> 6) % 4;
-	bool sweep_mute = pulse_sweeps[index].mute;
-	uint8_t reg_volume = pulse_regs[index][0] % 16;
+	uint64_t interval = 2 * (timer_period + 1);
+	uint64_t steps = (time - pulse_next_step[index]) / interval + 1;
+	duty_counters[index] = (duty_counters[index] + steps) % DUTY_CYCLE_LENGTH;
+	pulse_next_step[index] += steps * interval;
+}
+
+void APU::triangle_advance(uint64_t time) {
+	if (time < triangle_next_step) {
+		return;
+	}
+
+	uint16_t timer_period = triangle_regs[2] + ((triangle_regs[3] % 8) << 8);
+	uint64_t interval = timer_period + 1;
+	uint64_t steps = (time - triangle_next_step) / interval + 1;
+	triangle_next_step += steps * interval;
+
+	//Periods under 2 are ultrasonic, so the triangle holds where it is rather than generating events every cycle.
+	if (triangle_linear_counter != 0 && triangle_length_counter != 0 && timer_period >= 2) {
+		triangle_divider = (triangle_divider + steps) % 32;
+	}
+}
+
+void APU::noise_advance(uint64_t time) {
+	if (time < noise_next_step) {
+		return;
+	}
 
-	if (duty_info[duty_index][duty_counters[index]] == 1 && !sweep_mute && pulse_length_counters[index] != 0 && timer_period >= 8)
-	{//All of these conditions must be met to output the envelope volume.
-	 //1. Duty sequence is not currently 0.
-	 //2. Sweep module hasn't muted the wave
-	 //3. Length counter is not 0
-	 //4. Period of timer is greater than or equal to 8.
-		if (const_vol) {
-		//If constant volume flag is set, than volume specified in register is output.
-			pulse_signals[index] = reg_volume;
+	uint64_t interval = noise_period_lookup(noise_regs[2] % 16);
+	uint64_t steps = (time - noise_next_step) / interval + 1;
+	noise_next_step += steps * interval;
+
+	//Closed form, so long silences don't cost more.
+	uint8_t mode_bit = (noise_regs[2] >> 7) % 2;
+	noise_shift_register = lfsr_jump(noise_shift_register, mode_bit == 1, steps);
+}
+
+void APU::dmc_advance(uint64_t time) {
+	uint64_t interval = dmc_period_lookup(dmc_regs[0] % 16);
+
+	while (time >= dmc_next_step) {
+		if (dmc_silence && dmc_empty && dmc_bytes_remaining == 0) {
+			//Nothing to play, so only the timer and the bit counter move.
+			uint64_t steps = (time - dmc_next_step) / interval + 1;
+			dmc_bits_remaining = (dmc_bits_remaining + 7 - steps % 8) % 8 + 1;
+			dmc_next_step += steps * interval;
+			break;
+		}
+
+		dmc_step();
+		dmc_next_step += interval;
+	}
+}
+
+void APU::dmc_step() {
+//One timer period of the output unit.
+	if (!dmc_silence) {
+		uint8_t next_bit = dmc_shift_reg % 2;
+		if (next_bit == 1 && dmc_signal <= 125) {
+			dmc_signal += 2;
+		}
+
+		else if (next_bit == 0 && dmc_signal >= 2) {
+			dmc_signal -= 2;
+		}
+	}
+
+	dmc_shift_reg = dmc_shift_reg >> 1;
+	dmc_bits_remaining--;
+	if (dmc_bits_remaining == 0) {
+		dmc_bits_remaining = 8;
+		if (dmc_empty) {
+			dmc_silence = true;
 		}
 
 		else {
-		//Use the decay volume in the pulse sweep module.
-			pulse_signals[index] = pulse_envelopes[index].decay_counter; 
+			dmc_silence = false;
+			dmc_shift_reg = dmc_buffer;
+			dmc_empty = true;
+			dmc_fetch();
 		}
-	}	
+	}
+}
 
-	else {
-	//If conditions above not met, output = 0.
-		pulse_signals[index] = 0;
-	}	
+void APU::dmc_fetch() {
+//Refills the sample buffer as soon as it empties.
+	if (!dmc_empty || dmc_bytes_remaining == 0) {
+		return;
+	}
 
-	
-	
-	if (pulse_dividers[index] == 0) {
-		 duty_counters[index] = (duty_counters[index] + 1) % 8;
-		 pulse_dividers[index] = timer_period;
+	uint8_t loop_flag = (dmc_regs[0] >> 6) % 2;
+	uint8_t irq_flag = (dmc_regs[0] >> 7) % 2;
+
+	dmc_empty = false;
+	dmc_buffer = memory->mem_read(dmc_current_address);
+	if (dmc_current_address == 0xFFFF) {
+		dmc_current_address = 0x8000;
 	}
 
 	else {
-		 pulse_dividers[index]--;
+		dmc_current_address++;
 	}
-}
 
-void APU::triangle_update() {
-	uint8_t timer_period = triangle_regs[2] + ((triangle_regs[3] % 8) << 8);
-	if (triangle_timer == 0) {
-		triangle_timer = timer_period;
-		if (triangle_linear_counter != 0 && triangle_length_counter != 0) {
-			triangle_divider = (triangle_divider + 1) % 32;
-		}
+	dmc_bytes_remaining--;
+	if (dmc_bytes_remaining == 0 && loop_flag == 1) {
+		dmc_restart();
 	}
 
-	if (triangle_divider <= 15) {
-		triangle_signal = 15 - triangle_divider;
+	else if (dmc_bytes_remaining == 0 && irq_flag == 1) {
+	//Process interrupt request here
 	}
+}
 
-	else {
-		triangle_signal = triangle_divider - 16;
+void APU::dmc_restart() {
+	dmc_current_address = 0xC000 + (dmc_regs[2] << 6);
+	dmc_bytes_remaining = (dmc_regs[3] << 4) + 1;
+}
+
+uint8_t APU::pulse_volume(uint8_t index) {
+	uint8_t const_vol = (pulse_regs[index][0] >> 4) % 2;
+	uint16_t timer_period = pulse_regs[index][2] + ((pulse_regs[index][3] % 8) << 8);
+	bool sweep_mute = pulse_sweeps[index].mute;
+	uint8_t reg_volume = pulse_regs[index][0] % 16;
+
+	if (!sweep_mute && pulse_length_counters[index] != 0 && timer_period >= 8)
+	{//All of these conditions must be met to output the envelope volume while the duty sequence is high.
+	 //1. Sweep module hasn't muted the wave
+	 //2. Length counter is not 0
+	 //3. Period of timer is greater than or equal to 8.
+		return const_vol ? reg_volume : pulse_envelopes[index].decay_counter;
 	}
+	return 0;
 }
 
-void APU::noise_update() {
+uint8_t APU::noise_volume() {
 	uint8_t const_vol = (noise_regs[0] >> 4) % 2;
-	uint8_t mode_bit = (noise_regs[2] >> 7) % 2;
-	uint8_t xor_bit_index = (mode_bit == 1) ? 6 : 1;
-	uint8_t feedback;
 	uint8_t reg_volume = noise_regs[0] % 16;
-	uint8_t timer_period = noise_period_lookup(noise_regs[2] % 16);
 
-	if (noise_timer == 0) {
-		feedback = (noise_shift_register % 2) ^ ((noise_shift_register >> xor_bit_index) % 2);
-		noise_shift_register = noise_shift_register >> 1;
-		noise_shift_register |= feedback << 14;
-		noise_timer = timer_period;
+	if (noise_length_counter != 0) {
+		return const_vol == 1 ? reg_volume : noise_envelope.decay_counter;
 	}
+	return 0;
+}
 
-	else {
-		noise_timer--;
-	}
+void APU::pulse_update(uint8_t index) {
+//Works out the pulse's output now, and how long until the duty sequence next flips it.
+	uint16_t timer_period = pulse_regs[index][2] + ((pulse_regs[index][3] % 8) << 8);
+	uint8_t duty_index = (pulse_regs[index][0] >> 6) % 4;
+	uint8_t volume = pulse_volume(index);
 
-	if ((noise_shift_register % 2 == 0) && noise_length_counter != 0) {
-		if (const_vol == 1) {
-			noise_signal = reg_volume;
-		}
+	const std::array<uint8_t, DUTY_CYCLE_LENGTH>& duty = duty_info[duty_index];
+	uint8_t position = duty_counters[index];
+	pulse_signals[index] = duty[position] == 1 ? volume : 0;
 
-		else {
-			noise_signal = noise_envelope.decay_counter;
-		}
+	if (volume == 0) {
+		next_change[CHANNEL_PULSE1 + index] = APU_NEVER;
+		return;
 	}
 
-	else {
-		noise_signal = 0;
+	//Every duty sequence has both levels, so this is at most 7 steps.
+	uint8_t steps = 1;
+	while (duty[(position + steps) % DUTY_CYCLE_LENGTH] == duty[position]) {
+		steps++;
 	}
+	next_change[CHANNEL_PULSE1 + index] = pulse_next_step[index] + (steps - 1) * 2 * (timer_period + 1);
 }
 
-void APU::dmc_update() {
-	uint8_t timer_period = dmc_period_lookup(dmc_regs[0] % 16);
+void APU::triangle_update() {
+	uint16_t timer_period = triangle_regs[2] + ((triangle_regs[3] % 8) << 8);
 
-	if (dmc_restart && dmc_bits_remaining == 0) {
-		dmc_bytes_remaining = dmc_regs[3];
-		dmc_restart = false;
-		dmc_current_address = dmc_regs[2];
+	if (triangle_divider <= 15) {
+		triangle_signal = 15 - triangle_divider;
 	}
 
-	if (dmc_bytes_remaining != 0 && dmc_empty) {
-		uint8_t loop_flag = (dmc_regs[0] >> 6) % 2;
-		uint8_t irq_flag = (dmc_regs[0] >> 7) % 2;
-
-		dmc_empty = false;
-		dmc_buffer = memory->mem_read(dmc_current_address);
-		if (dmc_current_address == 0xFFFF) {
-			dmc_current_address = 0x8000;
-		}
+	else {
+		triangle_signal = triangle_divider - 16;
+	}
 
-		else {
-			dmc_current_address++;
-		}
+	if (triangle_linear_counter == 0 || triangle_length_counter == 0 || timer_period < 2) {
+		next_change[CHANNEL_TRIANGLE] = APU_NEVER;
+		return;
+	}
 
-		dmc_bytes_remaining--;
-		if (dmc_bytes_remaining == 0 && loop_flag == 1) {
-			dmc_restart = true;
-		}
+	//Every step changes the output, except at the bottom and top where the level repeats.
+	next_change[CHANNEL_TRIANGLE] = triangle_next_step + (triangle_divider % 16 == 15 ? timer_period + 1 : 0);
+}
 
-		else if (dmc_bytes_remaining == 0 && irq_flag == 1) {
-		//Process interrupt request here
-		}
-		
-	}	
+void APU::noise_update() {
+	uint8_t mode_bit = (noise_regs[2] >> 7) % 2;
+	uint8_t volume = noise_volume();
 
+	noise_signal = (noise_shift_register % 2 == 0) ? volume : 0;
 
+	if (volume == 0 || noise_shift_register == 0) {
+		next_change[CHANNEL_NOISE] = APU_NEVER;
+		return;
+	}
 
-	if (dmc_timer == 0) {
-		dmc_timer = timer_period;
-		if (!dmc_silence) {
-			uint8_t next_bit = dmc_shift_reg % 2;
-			if (next_bit == 1 && dmc_signal <= 125) {
-				dmc_signal += 2;
-			}
+	//Look ahead in the shift register for the next step that flips bit 0.
+	uint16_t shift_register = lfsr_step(noise_shift_register, mode_bit == 1);
+	uint64_t steps = 1;
+	while ((shift_register % 2) == (noise_shift_register % 2) && steps < 32767) {
+		shift_register = lfsr_step(shift_register, mode_bit == 1);
+		steps++;
+	}
+	next_change[CHANNEL_NOISE] = noise_next_step + (steps - 1) * noise_period_lookup(noise_regs[2] % 16);
+}
 
-			else if (next_bit == 0 && dmc_signal >= 2) {
-				dmc_signal -= 2;
-			}
-		}
-		dmc_bits_remaining--;
-		dmc_shift_reg = dmc_shift_reg >> 2;
-		if (dmc_bits_remaining == 0) {
-			dmc_bits_remaining = 8;
-			if (dmc_empty) {
-				dmc_silence = true;
-			}
+void APU::dmc_update() {
+//While the DMC is playing any step may move the output, so it gets an event every timer period.
+	if (dmc_silence && dmc_empty && dmc_bytes_remaining == 0) {
+		next_change[CHANNEL_DMC] = APU_NEVER;
+	}
 
-			else {
-				dmc_silence = false;
-				dmc_shift_reg = dmc_buffer;
-				dmc_empty = true;
+	else {
+		next_change[CHANNEL_DMC] = dmc_next_step;
+	}
+}
 
-			}
+void APU::advance_channel(uint8_t channel, uint64_t time) {
+	switch (channel) {
+		case CHANNEL_PULSE1:
+		case CHANNEL_PULSE2: {
+			pulse_advance(channel - CHANNEL_PULSE1, time);
+			break;
+		}
+		case CHANNEL_TRIANGLE: {
+			triangle_advance(time);
+			break;
+		}
+		case CHANNEL_NOISE: {
+			noise_advance(time);
+			break;
 		}
+		case CHANNEL_DMC: {
+			dmc_advance(time);
+			break;
+		}
+	}
+}
 
+void APU::update_channel(uint8_t channel) {
+	switch (channel) {
+		case CHANNEL_PULSE1:
+		case CHANNEL_PULSE2: {
+			pulse_update(channel - CHANNEL_PULSE1);
+			break;
+		}
+		case CHANNEL_TRIANGLE: {
+			triangle_update();
+			break;
+		}
+		case CHANNEL_NOISE: {
+			noise_update();
+			break;
+		}
+		case CHANNEL_DMC: {
+			dmc_update();
+			break;
+		}
 	}
+}
 
-	else {
-		dmc_timer--;
+void APU::output_changed(uint64_t time) {
+//Only changes in the mixed output go to the resampler.
+	int16_t signal = mix_waves();
+	if (signal != current_signal) {
+		blip->add_delta(time - block_start, signal - current_signal);
+		current_signal = signal;
 	}
 }
 
@@ -530,59 +660,214 @@ void APU::frame_clock() {
 	}
 }
 
-/*
-
-SDL_AudioCallback callback(void* userdata, Uint8* stream, int len) {
-
+void APU::audio_callback(void* userdata, Uint8* stream, int len) {
+//Runs on SDL's audio thread. It only ever reads from the ring, so it never waits on the emulation.
+	AudioRing* ring = (AudioRing*) userdata;
+	ring->read((int16_t*) stream, len / sizeof(int16_t));
 }
 
-*/
-
 
 void APU::initialize_SDL() {
 
 	SDL_AudioSpec want, have;
-	want.freq = 11025;
-	want.format = AUDIO_U8;
+	SDL_zero(want);
+	want.freq = AUDIO_SAMPLE_RATE;
+	want.format = AUDIO_S16SYS;
 	want.channels = 1;
-	want.callback = NULL;
+	want.samples = AUDIO_DEVICE_SAMPLES;
 
-	//SDL_AudioInit("sndio");
-	//std::cout << SDL_GetNumAudioDrivers() << "\n";
-	//std::cout << SDL_GetCurrentAudioDriver() << "\n";
-	std::cout << SDL_GetNumAudioDevices(0) << "\n";
-	for (int i = 0; i < 6; i++) {
-		std::cout << SDL_GetAudioDriver(i) << "\n";
-	//	std::cout << SDL_GetNumAudioDevices(0) << "\n";
-//		std::cout << SDL_GetAudioDeviceName(0, 0) << "\n";
-	}
+	ring = std::make_shared<AudioRing>(AUDIO_RING_SAMPLES);
+	want.callback = audio_callback;
+	want.userdata = ring.get();
 
-	device = SDL_OpenAudioDevice(SDL_GetAudioDeviceName(0, 0), 0, &want, &have, 0);
+	//Devices that only do 44.1 kHz get that instead, the resampler follows whatever rate is opened.
+	device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
 	if (device == 0) {
 		std::cout << "Error in opening audio device " << SDL_GetError() << "\n";
 	}
 
+	else {
+		sample_rate = have.freq;
+	}
+
+	//Room for a block at the highest rate a device is likely to give us.
+	blip = std::make_shared<BlipBuffer>(APU_CLOCK_RATE, sample_rate, AUDIO_BLOCK_CLOCKS * 192000.0 / APU_CLOCK_RATE + 1);
+	samples.resize(AUDIO_BLOCK_CLOCKS * 192000.0 / APU_CLOCK_RATE + 1);
+
 	SDL_PauseAudioDevice(device, 0);	
 
 }
 
-void APU::send_byte_to_SDL() {
-	SDL_QueueAudio(device, &current_signal, 1);
+void APU::end_audio_block() {
+//Finishes the samples for the block so far and hands them to the callback through the ring.
+	blip->end_block(AUDIO_BLOCK_CLOCKS);
+	block_start += AUDIO_BLOCK_CLOCKS;
+
+	//Rate control. Emulation and the sound card run off different clocks, so the output rate is nudged
+	//by up to AUDIO_MAX_SKEW to keep the ring near its target: more samples when it's draining, fewer when it's filling.
+	//The callback empties the ring a device buffer at a time, so the fill level is averaged over several blocks.
+	average_fill += ((double) ring->fill() - average_fill) / 16;
+	double target = AUDIO_TARGET_FILL * sample_rate / AUDIO_SAMPLE_RATE;
+	double error = std::min(std::max((target - average_fill) / target, -1.0), 1.0);
+
+	size_t count = blip->read_samples(samples.data(), samples.size());
+	ring->write(samples.data(), count);
+	blip->set_rates(APU_CLOCK_RATE, sample_rate * (1 + AUDIO_MAX_SKEW * error));
+}
+
+
+void APU::run(uint64_t cycles) {
+//Channels only need bringing up to date when a register is touched or an audio block is due, so time is just
+//banked here. That makes the stretches sync() covers long enough for the block kernels to pay off.
+	apu_target += cycles;
+	if (apu_target >= block_start + AUDIO_BLOCK_CLOCKS) {
+		sync();
+	}
+}
+
+void APU::sync() {
+//Catches up to apu_target, jumping from one channel output change to the next, or rendering busy stretches whole.
+	while (apu_time < apu_target) {
+		uint64_t block_end = block_start + AUDIO_BLOCK_CLOCKS;
+		uint64_t until = std::min(apu_target, block_end);
+
+		if (render_pays(until - apu_time)) {
+			render(until);
+		}
+
+		else {
+			while (true) {
+				uint8_t channel = 0;
+				for (uint8_t i = 1; i < NUM_CHANNELS; i++) {
+					if (next_change[i] < next_change[channel]) {
+						channel = i;
+					}
+				}
+
+				uint64_t time = next_change[channel];
+				if (time >= until) {
+					break;
+				}
+
+				advance_channel(channel, time);
+				update_channel(channel);
+				output_changed(time);
+			}
+		}
+
+		apu_time = until;
+		if (apu_time == block_end) {
+			end_audio_block();
+		}
+	}
+}
+
+bool APU::render_pays(uint64_t cycles) {
+//Rough count of output changes in the stretch: a pulse moves twice per duty cycle, the triangle on nearly every step,
+//noise on about every other step and the DMC is stepped every period while it plays.
+	if (cycles < APU_RENDER_MIN_CYCLES) {
+		return false;
+	}
+
+	double changes = 0;
+	for (uint8_t index = 0; index < NUM_PULSE_WAVES; index++) {
+		if (next_change[CHANNEL_PULSE1 + index] != APU_NEVER) {
+			uint16_t timer_period = pulse_regs[index][2] + ((pulse_regs[index][3] % 8) << 8);
+			changes += cycles / (8.0 * (timer_period + 1));
+		}
+	}
+
+	if (next_change[CHANNEL_TRIANGLE] != APU_NEVER) {
+		uint16_t timer_period = triangle_regs[2] + ((triangle_regs[3] % 8) << 8);
+		changes += cycles / (timer_period + 1.0);
+	}
+
+	if (next_change[CHANNEL_NOISE] != APU_NEVER) {
+		changes += cycles / (2.0 * noise_period_lookup(noise_regs[2] % 16));
+	}
+
+	if (next_change[CHANNEL_DMC] != APU_NEVER) {
+		changes += cycles / (double) dmc_period_lookup(dmc_regs[0] % 16);
+	}
+
+	return changes * APU_RENDER_SPACING > cycles;
 }
 
+void APU::render(uint64_t until) {
+//Renders every channel a cycle at a time up to until with the synth kernels, mixes through the DAC tables
+//and hands only the changes to the resampler. Channel state is then brought to the end of each chunk as usual.
+	static const std::array<uint8_t, 32> triangle_levels = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+								0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
 
-void APU::execute() {
-      pulse_update(0);
-      pulse_update(1);
-      //Note triangle updates twice in 1 APU cycle as specified in the documentation.
-      triangle_update();
-      triangle_update();
+	for (uint64_t time = apu_time; time < until;) {
+		size_t count = std::min<uint64_t>(SYNTH_CHUNK, until - time);
 
-      noise_update();
+		//Timers that ran on without changing the output haven't been followed, so they're caught up first.
+		for (uint8_t channel = 0; channel < CHANNEL_DMC; channel++) {
+			advance_channel(channel, time);
+		}
 
-      dmc_update();
+		for (uint8_t index = 0; index < NUM_PULSE_WAVES; index++) {
+			uint8_t* out = levels[CHANNEL_PULSE1 + index].data();
+			if (next_change[CHANNEL_PULSE1 + index] == APU_NEVER) {
+				std::memset(out, pulse_signals[index], count);
+				continue;
+			}
+
+			std::array<uint8_t, DUTY_CYCLE_LENGTH> duty;
+			uint8_t volume = pulse_volume(index);
+			for (uint8_t i = 0; i < DUTY_CYCLE_LENGTH; i++) {
+				duty[i] = duty_info[(pulse_regs[index][0] >> 6) % 4][i] ? volume : 0;
+			}
+			uint16_t timer_period = pulse_regs[index][2] + ((pulse_regs[index][3] % 8) << 8);
+			synth_sequence(out, count, duty.data(), DUTY_CYCLE_LENGTH - 1, duty_counters[index], pulse_next_step[index] - time, 2 * (timer_period + 1));
+		}
 
-      //initialize_SDL();
-      current_signal = mix_waves();
-      send_byte_to_SDL();
+		if (next_change[CHANNEL_TRIANGLE] == APU_NEVER) {
+			std::memset(levels[CHANNEL_TRIANGLE].data(), triangle_signal, count);
+		}
+
+		else {
+			uint16_t timer_period = triangle_regs[2] + ((triangle_regs[3] % 8) << 8);
+			synth_sequence(levels[CHANNEL_TRIANGLE].data(), count, triangle_levels.data(), 31, triangle_divider, triangle_next_step - time, timer_period + 1);
+		}
+
+		if (next_change[CHANNEL_NOISE] == APU_NEVER) {
+			std::memset(levels[CHANNEL_NOISE].data(), noise_signal, count);
+		}
+
+		else {
+			uint8_t mode_bit = (noise_regs[2] >> 7) % 2;
+			synth_noise(levels[CHANNEL_NOISE].data(), count, noise_volume(), noise_shift_register, mode_bit == 1, noise_next_step - time, noise_period_lookup(noise_regs[2] % 16));
+		}
+
+		//The DMC reads memory as it plays, so it's still stepped, filling runs between steps.
+		uint8_t* dmc_out = levels[CHANNEL_DMC].data();
+		for (size_t i = 0; i < count;) {
+			uint64_t next = next_change[CHANNEL_DMC];
+			size_t run = next == APU_NEVER ? count - i : std::min<uint64_t>(next - (time + i), count - i);
+			std::memset(dmc_out + i, dmc_signal, run);
+			i += run;
+			if (i < count) {
+				dmc_advance(time + i);
+				dmc_update();
+			}
+		}
+
+		synth_mix(levels[CHANNEL_PULSE1].data(), levels[CHANNEL_PULSE2].data(), levels[CHANNEL_TRIANGLE].data(), levels[CHANNEL_NOISE].data(),
+			  dmc_out, pulse_mix.data(), tnd_mix.data(), mixed.data(), count);
+
+		size_t found = synth_changes(mixed.data(), count, current_signal, changes.data());
+		for (size_t i = 0; i < found; i++) {
+			int16_t signal = mixed[changes[i]];
+			blip->add_delta(time + changes[i] - block_start, signal - current_signal);
+			current_signal = signal;
+		}
+
+		time += count;
+		for (uint8_t channel = 0; channel < CHANNEL_DMC; channel++) {
+			advance_channel(channel, time - 1);
+			update_channel(channel);
+		}
+	}
 }
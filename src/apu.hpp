@@ -3,7 +3,11 @@
 
 #include <SDL.h>
 #include "mem.hpp"
+#include "blip.hpp"
+#include "audioring.hpp"
+#include "synth.hpp"
 #include <iostream>
+#include <vector>
 #include <sndio.h>
 
 #define WAVE_REGS 4
@@ -25,6 +29,34 @@
 #define NUM_NOISE_PERIODS 16
 #define NUM_DMC_PERIODS 16
 
+#define NUM_CHANNELS 5
+#define CHANNEL_PULSE1 0
+#define CHANNEL_PULSE2 1
+#define CHANNEL_TRIANGLE 2
+#define CHANNEL_NOISE 3
+#define CHANNEL_DMC 4
+//A channel whose output can't change until a register write.
+#define APU_NEVER UINT64_MAX
+//Stretches at least this long are rendered with the block kernels when their channels change output more often than every
+//APU_RENDER_SPACING cycles on average. Quieter stretches are cheaper stepped from change to change.
+#define APU_RENDER_MIN_CYCLES 1024
+#define APU_RENDER_SPACING 24
+
+//Audio output. The APU keeps time in CPU cycles, and its output is resampled in blocks of a quarter of a video frame.
+#define APU_CLOCK_RATE 1789772.7
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_BLOCK_CLOCKS 7457
+//Samples SDL asks the callback for at a time.
+#define AUDIO_DEVICE_SAMPLES 512
+//Full scale mixer output, leaving headroom for the high pass filter to swing either side of zero.
+#define AUDIO_VOLUME 20000
+//Ring between the emulation and the audio callback, and the fill level rate control aims for, in samples.
+//The target plus the device buffer keeps latency under 30 ms.
+#define AUDIO_RING_SAMPLES 4096
+#define AUDIO_TARGET_FILL (AUDIO_SAMPLE_RATE * 16 / 1000)
+//Largest change rate control makes to the output rate, 0.5% either way.
+#define AUDIO_MAX_SKEW 0.005
+
 class Mem;
 
 struct Envelope {
@@ -42,9 +74,10 @@ struct Sweep {
 
 
 class APU {
-//IMPORTANT: Execution of the frame clock takes place at a different rate than executing the APU cycle. Moreover, wave generators are clocked at different rates than the components that feed values
+//IMPORTANT: Execution of the frame clock takes place at a different rate than the wave timers. Moreover, wave generators are clocked at different rates than the components that feed values
 //to the waves, such as the sweep module and the envelope generator. 1 frame clock = 3728 APU cycles, so keep this in mind when deciding to execute the frame_clock function.
-//The execute function executes a single APU cycle. All the wave timers are clocked every APU cycle(except for triangle wave, which is clocked twice per APU cycle).
+//The wave timers are not clocked one cycle at a time. Each channel works out when its timer next expires and when its output next changes, and run() jumps from one
+//output change to the next. Channels are also brought up to date when a register write affects them, so the cost follows the sound rather than the clock.
 //Envelopes and length counters are clocked at a half-frame rate(every 2 frame clocks) and linear counters and sweeps are clocked at a quarter-frame rate(every frame clock).
 
 private:
@@ -59,45 +92,44 @@ private:
 	std::array<uint16_t, NUM_NOISE_PERIODS> noise_period_table = {4, 8, 16, 32, 64, 96, 128, 160, 202,254, 380, 508, 762, 1016, 2034, 4068};
 	std::array<uint16_t, NUM_DMC_PERIODS> dmc_period_table = {428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54};
 
-	std::array<std::array<uint8_t, WAVE_REGS>, NUM_PULSE_WAVES> pulse_regs;
+	std::array<std::array<uint8_t, WAVE_REGS>, NUM_PULSE_WAVES> pulse_regs = {};
 	std::array<uint8_t, NUM_PULSE_WAVES> pulse_signals = {0, 0};
 	std::array<bool, NUM_PULSE_WAVES> pulse_silence;
-	std::array<uint8_t, NUM_PULSE_WAVES> pulse_length_counters;
+	std::array<uint8_t, NUM_PULSE_WAVES> pulse_length_counters = {0, 0};
 	std::array<uint8_t, NUM_PULSE_WAVES> duty_counters = {0, 0};
-	std::array<struct Envelope, NUM_PULSE_WAVES> pulse_envelopes;
+	std::array<struct Envelope, NUM_PULSE_WAVES> pulse_envelopes = {};
 	std::array<struct Sweep, NUM_PULSE_WAVES> pulse_sweeps;
-	std::array<uint8_t, NUM_PULSE_WAVES> pulse_dividers = {0, 0};
+	std::array<uint64_t, NUM_PULSE_WAVES> pulse_next_step = {0, 0};
 
-	std::array<uint8_t, WAVE_REGS> triangle_regs;
+	std::array<uint8_t, WAVE_REGS> triangle_regs = {};
 	uint8_t triangle_signal = 0;
 	bool triangle_silence = true;
-	uint8_t triangle_length_counter;
+	uint8_t triangle_length_counter = 0;
 	uint8_t triangle_envelope;
-	uint8_t triangle_linear_counter;
+	uint8_t triangle_linear_counter = 0;
 	bool triangle_reload_flag = false;
-	uint8_t triangle_timer = 0;
 	uint8_t triangle_divider = 0;
+	uint64_t triangle_next_step = 0;
 
-	std::array<uint8_t, WAVE_REGS> noise_regs;
+	std::array<uint8_t, WAVE_REGS> noise_regs = {};
 	uint8_t noise_signal = 0;
 	bool noise_silence = true;
-	uint8_t noise_length_counter;
-	uint16_t noise_shift_register;
-	struct Envelope noise_envelope;
-	uint8_t noise_timer = 0;
+	uint8_t noise_length_counter = 0;
+	uint16_t noise_shift_register = 1;
+	struct Envelope noise_envelope = {};
+	uint64_t noise_next_step = 0;
 
-	std::array<uint8_t, WAVE_REGS> dmc_regs;
+	std::array<uint8_t, WAVE_REGS> dmc_regs = {};
 	uint8_t dmc_signal = 0;
 	bool dmc_silence = true;
 	uint8_t dmc_length_counter;
-	uint8_t dmc_buffer;
-	uint8_t dmc_bytes_remaining = 0;
-	uint16_t dmc_current_address;
-	uint8_t dmc_timer = 0;
-	uint8_t dmc_bits_remaining = 0;
-	uint8_t dmc_shift_reg;
-	bool dmc_restart = false;
+	uint8_t dmc_buffer = 0;
+	uint16_t dmc_bytes_remaining = 0;
+	uint16_t dmc_current_address = 0;
+	uint8_t dmc_bits_remaining = 8;
+	uint8_t dmc_shift_reg = 0;
 	bool dmc_empty = true;
+	uint64_t dmc_next_step = 0;
 
 	uint8_t status_reg;
 	uint8_t frame_counter;
@@ -106,13 +138,34 @@ private:
 
 	uint8_t current_clock;
 
-	uint8_t current_signal = 128;
+	int16_t current_signal = 0;
+
+	//Event timing, in CPU cycles since power on. The next_step members above are when each timer next expires.
+	//apu_time is how far the channels have been run, apu_target how far the CPU has got.
+	uint64_t apu_time = 0;
+	uint64_t apu_target = 0;
+	std::array<uint64_t, NUM_CHANNELS> next_change = {APU_NEVER, APU_NEVER, APU_NEVER, APU_NEVER, APU_NEVER};
+
+	//DAC tables, with the spare entry the synth mixer wants, and scratch for rendering.
+	std::array<int16_t, PULSE_MIX_ENTRIES + 1> pulse_mix = {};
+	std::array<int16_t, TND_MIX_ENTRIES + 1> tnd_mix = {};
+	std::array<std::array<uint8_t, SYNTH_CHUNK>, NUM_CHANNELS> levels;
+	std::array<int16_t, SYNTH_CHUNK> mixed;
+	std::array<uint16_t, SYNTH_CHUNK> changes;
+
+	std::shared_ptr<BlipBuffer> blip;
+	std::vector<int16_t> samples;
+	uint64_t block_start = 0;
 
+	std::shared_ptr<AudioRing> ring;
+	int sample_rate = AUDIO_SAMPLE_RATE;
+	double average_fill = 0;
 
-	SDL_AudioDeviceID device;
+	SDL_AudioDeviceID device = 0;
 
 public:
 	APU(std::shared_ptr<Mem> memory); 
+	~APU();
 	uint8_t length_lookup(uint8_t index);
 	uint16_t noise_period_lookup(uint8_t index);
 	uint16_t dmc_period_lookup(uint8_t index);
@@ -122,24 +175,42 @@ public:
 	void clock_envelope(struct Envelope& envelope, uint8_t& info_reg);
 	void clock_sweep(struct Sweep& sweep, uint8_t& info_reg);
 
+	void pulse_advance(uint8_t index, uint64_t time);
+	void triangle_advance(uint64_t time);
+	void noise_advance(uint64_t time);
+	void dmc_advance(uint64_t time);
+	void dmc_step();
+	void dmc_fetch();
+	void dmc_restart();
+
+	uint8_t pulse_volume(uint8_t index);
+	uint8_t noise_volume();
+
 	void pulse_update(uint8_t index);
 	void triangle_update();
 	void noise_update();
 	void dmc_update();
 
+	void advance_channel(uint8_t channel, uint64_t time);
+	void update_channel(uint8_t channel);
+	void output_changed(uint64_t time);
+
 	void status_reg_changes();
 	void frame_counter_changes();
 
 	void reg_write(uint64_t index, uint8_t value);
 	uint8_t reg_read(uint64_t index);
 
-	uint8_t mix_waves();
+	int16_t mix_waves();
 	void frame_clock();
-	void execute();
+	void run(uint64_t cycles);
+	void sync();
+	bool render_pays(uint64_t cycles);
+	void render(uint64_t until);
 
-	SDL_AudioCallback callback(void* userdata, Uint8* stream, int len);
+	static void audio_callback(void* userdata, Uint8* stream, int len);
 	void initialize_SDL();
-	void send_byte_to_SDL();
+	void end_audio_block();
 
 };
 
@@ -0,0 +1,74 @@
+#include "audioring.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static size_t round_up_pow2(size_t size) {
+    size_t rounded = 1;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+AudioRing::AudioRing(size_t size) : samples(round_up_pow2(size), 0) {
+    mask = samples.size() - 1;
+    head = 0;
+    tail = 0;
+    underruns = 0;
+    overruns = 0;
+}
+
+size_t AudioRing::write(const int16_t* data, size_t count) {
+    uint64_t position = head.load(std::memory_order_relaxed);
+    size_t space = samples.size() - (position - tail.load(std::memory_order_acquire));
+    if (count > space) {
+        overruns++;
+        count = space;
+    }
+
+    // at most two copies, before and after the wrap
+    size_t start = position & mask;
+    size_t first = std::min(count, samples.size() - start);
+    std::memcpy(samples.data() + start, data, first * sizeof(int16_t));
+    std::memcpy(samples.data(), data + first, (count - first) * sizeof(int16_t));
+
+    head.store(position + count, std::memory_order_release);
+    return count;
+}
+
+void AudioRing::read(int16_t* data, size_t count) {
+    uint64_t position = tail.load(std::memory_order_relaxed);
+    size_t avail = head.load(std::memory_order_acquire) - position;
+    size_t taken = std::min(count, avail);
+
+    size_t start = position & mask;
+    size_t first = std::min(taken, samples.size() - start);
+    std::memcpy(data, samples.data() + start, first * sizeof(int16_t));
+    std::memcpy(data + first, samples.data(), (taken - first) * sizeof(int16_t));
+    tail.store(position + taken, std::memory_order_release);
+
+    if (taken > 0) {
+        last = data[taken - 1];
+    }
+    if (taken < count) {
+        underruns++;
+        std::fill(data + taken, data + count, last);
+    }
+}
+
+size_t AudioRing::fill() {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+size_t AudioRing::capacity() {
+    return samples.size();
+}
+
+uint64_t AudioRing::get_underruns() {
+    return underruns;
+}
+
+uint64_t AudioRing::get_overruns() {
+    return overruns;
+}
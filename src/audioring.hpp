@@ -0,0 +1,45 @@
+#ifndef audioring_hpp
+#define audioring_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+
+// Samples on their way from the emulation thread to the SDL audio callback.
+// One writer and one reader, no locks; head and tail count up forever and
+// the size is a power of two so positions wrap with a mask.
+
+class AudioRing {
+private:
+    std::vector<int16_t> samples;
+    size_t mask;
+
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+
+    // last sample read, repeated when the ring runs dry so it doesn't click
+    int16_t last = 0;
+
+    std::atomic<uint64_t> underruns;
+    std::atomic<uint64_t> overruns;
+
+public:
+    // size is rounded up to a power of two
+    AudioRing(size_t size);
+
+    // writer side, what doesn't fit is dropped and counted
+    size_t write(const int16_t* data, size_t count);
+
+    // reader side, always fills count samples
+    void read(int16_t* data, size_t count);
+
+    // either side, a snapshot that may be stale by the time it's used
+    size_t fill();
+    size_t capacity();
+
+    uint64_t get_underruns();
+    uint64_t get_overruns();
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "blip.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// passband edge as a fraction of the output rate, just under nyquist
+#define BLIP_CUTOFF     0.45
+
+BlipBuffer::BlipBuffer(double clock_rate, double sample_rate, size_t max_samples) : buffer(max_samples + BLIP_TAPS + 1, 0) {
+    build_kernel();
+    set_rates(clock_rate, sample_rate);
+}
+
+void BlipBuffer::build_kernel() {
+    for (int phase = 0; phase < BLIP_PHASES; phase++) {
+        double fraction = (double) phase / BLIP_PHASES;
+        std::array<double, BLIP_TAPS> taps;
+        double total = 0;
+
+        // blackman windowed sinc, centred half the kernel after the step
+        for (int tap = 0; tap < BLIP_TAPS; tap++) {
+            double x = tap - BLIP_TAPS / 2 - fraction;
+            double y = 2 * BLIP_CUTOFF * x;
+            double sinc = x == 0 ? 1 : std::sin(M_PI * y) / (M_PI * y);
+            double window = 0.42 + 0.5 * std::cos(2 * M_PI * x / BLIP_TAPS) + 0.08 * std::cos(4 * M_PI * x / BLIP_TAPS);
+            taps[tap] = std::abs(x) < BLIP_TAPS / 2 ? sinc * window : 0;
+            total += taps[tap];
+        }
+
+        // every phase sums to exactly one, so steps settle without drift
+        int32_t sum = 0;
+        int largest = 0;
+        for (int tap = 0; tap < BLIP_TAPS; tap++) {
+            kernel[phase][tap] = (int16_t) std::lround(taps[tap] / total * (1 << BLIP_KERNEL_BITS));
+            sum += kernel[phase][tap];
+            if (kernel[phase][tap] > kernel[phase][largest]) {
+                largest = tap;
+            }
+        }
+        kernel[phase][largest] += (1 << BLIP_KERNEL_BITS) - sum;
+    }
+}
+
+void BlipBuffer::set_rates(double clock_rate, double sample_rate) {
+    factor = (uint64_t) std::llround(sample_rate / clock_rate * ((uint64_t) 1 << BLIP_TIME_BITS));
+}
+
+void BlipBuffer::add_delta(uint32_t time, int32_t delta) {
+    uint64_t position = offset + time * factor;
+    int32_t* out = buffer.data() + (position >> BLIP_TIME_BITS);
+    const std::array<int16_t, BLIP_TAPS>& taps = kernel[(position >> (BLIP_TIME_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+
+    for (int tap = 0; tap < BLIP_TAPS; tap++) {
+        out[tap] += delta * taps[tap];
+    }
+}
+
+void BlipBuffer::end_block(uint32_t clocks) {
+    offset += clocks * factor;
+    avail = offset >> BLIP_TIME_BITS;
+    if (avail + BLIP_TAPS + 1 > buffer.size()) {
+        throw std::out_of_range("audio block too long");
+    }
+}
+
+size_t BlipBuffer::samples_avail() {
+    return avail;
+}
+
+size_t BlipBuffer::read_samples(int16_t* out, size_t count) {
+    count = std::min(count, avail);
+
+    int32_t sum = integrator;
+    for (size_t i = 0; i < count; i++) {
+        int32_t sample = sum >> BLIP_KERNEL_BITS;
+        sum += buffer[i];
+        out[i] = (int16_t) std::min(std::max(sample, -32768), 32767);
+        sum -= sample << (BLIP_KERNEL_BITS - BLIP_BASS_SHIFT);
+    }
+    integrator = sum;
+
+    // what's left, including kernel tails reaching past the block
+    size_t remaining = avail - count + BLIP_TAPS;
+    std::memmove(buffer.data(), buffer.data() + count, remaining * sizeof(int32_t));
+    std::fill(buffer.begin() + remaining, buffer.begin() + remaining + count, 0);
+
+    offset -= (uint64_t) count << BLIP_TIME_BITS;
+    avail -= count;
+    return count;
+}
+
+void BlipBuffer::clear() {
+    std::fill(buffer.begin(), buffer.end(), 0);
+    offset = 0;
+    avail = 0;
+    integrator = 0;
+}
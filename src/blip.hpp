@@ -0,0 +1,56 @@
+#ifndef blip_hpp
+#define blip_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+
+// Band-limited step synthesis. Amplitude changes are added as deltas at
+// clock timestamps within a block, each one spread over a few output samples
+// by a windowed sinc step, so square waves come out without aliasing at any
+// output rate. Ending a block makes its samples readable as int16.
+
+// kernel width in output samples, and fractional positions between them
+#define BLIP_TAPS           16
+#define BLIP_PHASE_BITS     6
+#define BLIP_PHASES         (1 << BLIP_PHASE_BITS)
+#define BLIP_KERNEL_BITS    15
+
+// positions are 32.32 fixed point output samples
+#define BLIP_TIME_BITS      32
+
+// high pass, removes DC like the console's own output filter
+#define BLIP_BASS_SHIFT     9
+
+class BlipBuffer {
+private:
+    std::array<std::array<int16_t, BLIP_TAPS>, BLIP_PHASES> kernel;
+
+    // output samples per clock, and where clock 0 of this block falls
+    uint64_t factor;
+    uint64_t offset = 0;
+
+    // deltas, integrated into samples as they're read
+    std::vector<int32_t> buffer;
+    int32_t integrator = 0;
+    size_t avail = 0;
+
+    void build_kernel();
+
+public:
+    // max_samples is the most a block may produce before it's read
+    BlipBuffer(double clock_rate, double sample_rate, size_t max_samples);
+
+    // takes effect at the next block, used to nudge the rate while running
+    void set_rates(double clock_rate, double sample_rate);
+
+    void add_delta(uint32_t time, int32_t delta);
+    void end_block(uint32_t clocks);
+
+    size_t samples_avail();
+    size_t read_samples(int16_t* out, size_t count);
+    void clear();
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "capture.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+Capture::Capture(const char* filename, uint8_t format, const uint32_t* colors, size_t ring) : slots(ring) {
+    if (format > CAPTURE_INDICES || ring == 0) {
+        throw std::invalid_argument("invalid capture format");
+    }
+    this->format = format;
+
+    fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("could not open capture file");
+    }
+
+    // full range BT.601, so flat colours survive the round trip
+    for (int i = 0; i < 512; i++) {
+        uint8_t r = colors[i] >> 16;
+        uint8_t g = colors[i] >> 8;
+        uint8_t b = colors[i];
+        rgb[i] = {r, g, b};
+
+        int y = (77 * r + 150 * g + 29 * b + 128) >> 8;
+        int u = ((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128;
+        int v = ((128 * r - 107 * g - 21 * b + 128) >> 8) + 128;
+        yuv[i] = {(uint8_t) std::min(std::max(y, 0), 255), (uint8_t) std::min(std::max(u, 0), 255), (uint8_t) std::min(std::max(v, 0), 255)};
+    }
+
+    head = 0;
+    tail = 0;
+    written = 0;
+    dropped = 0;
+    batched = 0;
+    running = true;
+
+    batch.reserve(CAPTURE_BATCH + CAPTURE_WIDTH * CAPTURE_HEIGHT * 3 + 64);
+    if (format == CAPTURE_Y4M) {
+        // the table is full range, which readers assume it isn't unless told
+        std::string header = "YUV4MPEG2 W256 H240 " CAPTURE_RATE " Ip A1:1 C444 XCOLORRANGE=FULL\n";
+        batch.insert(batch.end(), header.begin(), header.end());
+    }
+
+    writer = std::thread(&Capture::write_loop, this);
+}
+
+Capture::~Capture() {
+    running = false;
+    wake.notify_one();
+    writer.join();
+    close(fd);
+
+    std::cout << "Capture: " << written << " frames written, " << dropped << " dropped" << std::endl;
+}
+
+void Capture::push(const uint8_t* pixels, const uint8_t* emphasis) {
+    uint64_t position = head.load(std::memory_order_relaxed);
+    if (position - tail.load(std::memory_order_acquire) == slots.size()) {
+        dropped++;
+        return;
+    }
+
+    CaptureSlot& slot = slots[position % slots.size()];
+    std::memcpy(slot.pixels.data(), pixels, slot.pixels.size());
+    std::memcpy(slot.emphasis.data(), emphasis, slot.emphasis.size());
+    head.store(position + 1, std::memory_order_release);
+
+    // the writer also wakes up by itself, so this can't be lost for long
+    wake.notify_one();
+}
+
+uint64_t Capture::get_written() {
+    return written;
+}
+
+uint64_t Capture::get_dropped() {
+    return dropped;
+}
+
+// writer thread
+
+void Capture::write_loop() {
+    while (true) {
+        uint64_t position = tail.load(std::memory_order_relaxed);
+
+        if (position == head.load(std::memory_order_acquire)) {
+            // nothing queued, so whatever is batched goes out now
+            flush();
+            if (!running) {
+                break;
+            }
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait_for(guard, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        convert(slots[position % slots.size()]);
+        tail.store(position + 1, std::memory_order_release);
+        batched++;
+
+        if (batch.size() >= CAPTURE_BATCH) {
+            flush();
+        }
+    }
+}
+
+void Capture::convert(const CaptureSlot& slot) {
+    switch (format) {
+        case CAPTURE_Y4M: {
+            static const char frame_header[] = "FRAME\n";
+            batch.insert(batch.end(), frame_header, frame_header + 6);
+
+            // planar, Y then U then V
+            size_t start = batch.size();
+            size_t plane = CAPTURE_WIDTH * CAPTURE_HEIGHT;
+            batch.resize(start + plane * 3);
+            uint8_t* out = batch.data() + start;
+
+            for (int y = 0; y < CAPTURE_HEIGHT; y++) {
+                uint16_t emphasis = (slot.emphasis[y] & 0x7) << 6;
+                for (int x = 0; x < CAPTURE_WIDTH; x++) {
+                    int i = y * CAPTURE_WIDTH + x;
+                    const std::array<uint8_t, 3>& color = yuv[emphasis | (slot.pixels[i] & 0x3f)];
+                    out[i] = color[0];
+                    out[plane + i] = color[1];
+                    out[plane * 2 + i] = color[2];
+                }
+            }
+            break;
+        }
+        case CAPTURE_RGB: {
+            size_t start = batch.size();
+            batch.resize(start + CAPTURE_WIDTH * CAPTURE_HEIGHT * 3);
+            uint8_t* out = batch.data() + start;
+
+            for (int y = 0; y < CAPTURE_HEIGHT; y++) {
+                uint16_t emphasis = (slot.emphasis[y] & 0x7) << 6;
+                for (int x = 0; x < CAPTURE_WIDTH; x++) {
+                    const std::array<uint8_t, 3>& color = rgb[emphasis | (slot.pixels[y * CAPTURE_WIDTH + x] & 0x3f)];
+                    std::memcpy(out, color.data(), 3);
+                    out += 3;
+                }
+            }
+            break;
+        }
+        case CAPTURE_INDICES: {
+            batch.insert(batch.end(), slot.emphasis.begin(), slot.emphasis.end());
+            batch.insert(batch.end(), slot.pixels.begin(), slot.pixels.end());
+            break;
+        }
+    }
+}
+
+void Capture::flush() {
+    size_t done = 0;
+    while (done < batch.size()) {
+        ssize_t count = ::write(fd, batch.data() + done, batch.size() - done);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            // a full disk loses what's batched rather than stopping emulation
+            std::cout << "Capture: write failed" << std::endl;
+            dropped += batched;
+            batched = 0;
+            break;
+        }
+        done += count;
+    }
+    written += batched;
+    batched = 0;
+    batch.clear();
+}
+
+uint8_t capture_format(const std::string& filename) {
+    std::string ext = filename.size() > 4 ? filename.substr(filename.size() - 4) : "";
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    if (ext == ".y4m") {
+        return CAPTURE_Y4M;
+    } else if (ext == ".rgb") {
+        return CAPTURE_RGB;
+    }
+    return CAPTURE_INDICES;
+}
@@ -0,0 +1,84 @@
+#ifndef capture_hpp
+#define capture_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+// Lossless frame capture. The emulation thread copies each finished frame
+// (palette indices and per line emphasis) into a ring of preallocated slots
+// and carries on; a writer thread converts and writes them out in large
+// sequential writes. When the ring is full the frame is dropped and counted
+// rather than waiting on the disk.
+
+// output formats
+#define CAPTURE_Y4M         0   // YUV4MPEG2, 4:4:4
+#define CAPTURE_RGB         1   // raw 24 bit RGB
+#define CAPTURE_INDICES     2   // raw, 240 emphasis bytes then 256x240 indices
+
+#define CAPTURE_WIDTH       256
+#define CAPTURE_HEIGHT      240
+#define CAPTURE_RING        64
+
+// the writer flushes once this much is waiting
+#define CAPTURE_BATCH       (1 << 20)
+
+// NTSC NES frame rate, 60.0988 Hz
+#define CAPTURE_RATE        "F39375000:655171"
+
+struct CaptureSlot {
+    std::array<uint8_t, CAPTURE_WIDTH * CAPTURE_HEIGHT> pixels;
+    std::array<uint8_t, CAPTURE_HEIGHT> emphasis;
+};
+
+class Capture {
+private:
+    int fd;
+    uint8_t format;
+
+    // 512 colours by emphasis << 6 | index, as RGB and as YUV
+    std::array<std::array<uint8_t, 3>, 512> rgb;
+    std::array<std::array<uint8_t, 3>, 512> yuv;
+
+    // single producer, single consumer, head and tail count up forever
+    std::vector<CaptureSlot> slots;
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+
+    std::vector<uint8_t> batch;
+    // frames in batch, they count as written once it reaches the file
+    uint64_t batched;
+    std::atomic<bool> running;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread writer;
+
+    void write_loop();
+    void convert(const CaptureSlot& slot);
+    void flush();
+
+public:
+    // colors is the 512 entry ARGB table, every colour under each emphasis
+    Capture(const char* filename, uint8_t format, const uint32_t* colors, size_t ring = CAPTURE_RING);
+    ~Capture();
+
+    // never waits, a frame that doesn't fit is dropped
+    void push(const uint8_t* pixels, const uint8_t* emphasis);
+
+    uint64_t get_written();
+    uint64_t get_dropped();
+};
+
+// picks the format from the extension, .y4m, .rgb, otherwise indices
+uint8_t capture_format(const std::string& filename);
+
+#endif
@@ -0,0 +1,40 @@
+#include "chr.hpp"
+
+#include <array>
+
+// spread[b] puts bit 7 - x of b at bit 2x, flip_spread[b] puts bit x there
+static std::array<uint16_t, 256> make_spread(bool flip) {
+    std::array<uint16_t, 256> spread;
+    for (int b = 0; b < 256; b++) {
+        uint16_t value = 0;
+        for (int x = 0; x < 8; x++) {
+            int bit = flip ? x : 7 - x;
+            value |= ((b >> bit) & 1) << (x * 2);
+        }
+        spread[b] = value;
+    }
+    return spread;
+}
+
+static const std::array<uint16_t, 256> spread = make_spread(false);
+static const std::array<uint16_t, 256> flip_spread = make_spread(true);
+
+uint16_t chr_decode_row(uint8_t low, uint8_t high) {
+    return spread[low] | (spread[high] << 1);
+}
+
+uint16_t chr_decode_row_flipped(uint8_t low, uint8_t high) {
+    return flip_spread[low] | (flip_spread[high] << 1);
+}
+
+void chr_decode(const uint8_t* chr, uint32_t size, uint16_t* rows, uint16_t* flipped) {
+    for (uint32_t tile = 0; tile < size; tile += CHR_TILE) {
+        for (int y = 0; y < 8; y++) {
+            uint8_t low = chr[tile + y];
+            uint8_t high = chr[tile + y + 8];
+            uint32_t index = CHR_ROW_INDEX(tile + y);
+            rows[index] = chr_decode_row(low, high);
+            flipped[index] = chr_decode_row_flipped(low, high);
+        }
+    }
+}
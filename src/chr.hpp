@@ -0,0 +1,21 @@
+#ifndef chr_hpp
+#define chr_hpp
+
+#include <cstdint>
+
+// CHR is stored as two bitplanes per tile row. The renderer wants chunky rows
+// instead: one uint16_t per row with pixel x in bits 2x and 2x+1, so a row is a
+// single load and pixels come out with shifts. The flipped variant has the
+// pixels mirrored for horizontally flipped sprites.
+
+#define CHR_TILE        16
+#define CHR_ROWS(size)  ((size) / 2)
+
+// row index for a pattern table byte offset (either plane)
+#define CHR_ROW_INDEX(offset) ((((offset) >> 4) << 3) | ((offset) & 7))
+
+uint16_t chr_decode_row(uint8_t low, uint8_t high);
+uint16_t chr_decode_row_flipped(uint8_t low, uint8_t high);
+void chr_decode(const uint8_t* chr, uint32_t size, uint16_t* rows, uint16_t* flipped);
+
+#endif
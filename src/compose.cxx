@@ -0,0 +1,151 @@
+#include "compose.hpp"
+
+#include <array>
+#include <cstring>
+
+#if !defined(COMPOSE_SCALAR) && defined(__AVX2__)
+#define COMPOSE_AVX2
+#include <immintrin.h>
+#elif !defined(COMPOSE_SCALAR) && defined(__SSE2__)
+#define COMPOSE_SSE2
+#include <emmintrin.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#endif
+
+// expand[set][b] is the four pixels in row byte b as indices, little endian
+static std::array<std::array<uint32_t, 256>, 4> make_expand() {
+    std::array<std::array<uint32_t, 256>, 4> expand;
+    for (int set = 0; set < 4; set++) {
+        for (int b = 0; b < 256; b++) {
+            uint32_t value = 0;
+            for (int x = 0; x < 4; x++) {
+                uint8_t color = (b >> (x * 2)) & 0x3;
+                if (color) value |= (uint32_t) ((set << 2) | color) << (x * 8);
+            }
+            expand[set][b] = value;
+        }
+    }
+    return expand;
+}
+
+static const std::array<std::array<uint32_t, 256>, 4> expand = make_expand();
+
+void compose_tiles(const uint16_t* rows, const uint8_t* sets, int tiles, uint8_t* line) {
+    for (int tile = 0; tile < tiles; tile++) {
+        const std::array<uint32_t, 256>& table = expand[sets[tile] & 0x3];
+        uint32_t pixels[2] = {table[rows[tile] & 0xff], table[rows[tile] >> 8]};
+        std::memcpy(line + tile * 8, pixels, 8);
+    }
+}
+
+static inline uint8_t compose_pixel(uint8_t background, uint8_t sprite, const uint8_t* palette) {
+    uint8_t index = background;
+    if (sprite && (!(sprite & COMPOSE_BEHIND) || !background)) {
+        index = sprite & 0x1f;
+    }
+    return palette[index];
+}
+
+void compose_line(const uint8_t* background, const uint8_t* sprites, const uint8_t* palette, uint8_t* out, int count) {
+    int x = 0;
+    
+#if defined(COMPOSE_AVX2)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i behind = _mm256_set1_epi8((char) COMPOSE_BEHIND);
+    const __m256i index_mask = _mm256_set1_epi8(0x1f);
+    const __m256i high_half = _mm256_set1_epi8(0x10);
+    
+    // vpshufb looks up within each 128 bit lane, so both lanes get a copy
+    __m128i low = _mm_loadu_si128((const __m128i*) palette);
+    __m128i high = _mm_loadu_si128((const __m128i*) (palette + 16));
+    const __m256i palette_low = _mm256_broadcastsi128_si256(low);
+    const __m256i palette_high = _mm256_broadcastsi128_si256(high);
+    
+    for (; x + 32 <= count; x += 32) {
+        __m256i bg = _mm256_loadu_si256((const __m256i*) (background + x));
+        __m256i spr = _mm256_loadu_si256((const __m256i*) (sprites + x));
+        
+        __m256i bg_clear = _mm256_cmpeq_epi8(bg, zero);
+        __m256i spr_clear = _mm256_cmpeq_epi8(spr, zero);
+        __m256i front = _mm256_cmpeq_epi8(_mm256_and_si256(spr, behind), zero);
+        __m256i use_spr = _mm256_andnot_si256(spr_clear, _mm256_or_si256(front, bg_clear));
+        
+        __m256i index = _mm256_blendv_epi8(bg, _mm256_and_si256(spr, index_mask), use_spr);
+        
+        __m256i color_low = _mm256_shuffle_epi8(palette_low, index);
+        __m256i color_high = _mm256_shuffle_epi8(palette_high, index);
+        __m256i is_high = _mm256_cmpeq_epi8(_mm256_and_si256(index, high_half), high_half);
+        
+        _mm256_storeu_si256((__m256i*) (out + x), _mm256_blendv_epi8(color_low, color_high, is_high));
+    }
+#elif defined(COMPOSE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i behind = _mm_set1_epi8((char) COMPOSE_BEHIND);
+    const __m128i index_mask = _mm_set1_epi8(0x1f);
+#ifdef __SSSE3__
+    const __m128i high_half = _mm_set1_epi8(0x10);
+    const __m128i palette_low = _mm_loadu_si128((const __m128i*) palette);
+    const __m128i palette_high = _mm_loadu_si128((const __m128i*) (palette + 16));
+#endif
+    
+    for (; x + 16 <= count; x += 16) {
+        __m128i bg = _mm_loadu_si128((const __m128i*) (background + x));
+        __m128i spr = _mm_loadu_si128((const __m128i*) (sprites + x));
+        
+        __m128i bg_clear = _mm_cmpeq_epi8(bg, zero);
+        __m128i spr_clear = _mm_cmpeq_epi8(spr, zero);
+        __m128i front = _mm_cmpeq_epi8(_mm_and_si128(spr, behind), zero);
+        __m128i use_spr = _mm_andnot_si128(spr_clear, _mm_or_si128(front, bg_clear));
+        
+        // no blendv before SSE4.1
+        __m128i index = _mm_or_si128(_mm_and_si128(use_spr, _mm_and_si128(spr, index_mask)),
+                                     _mm_andnot_si128(use_spr, bg));
+        
+#ifdef __SSSE3__
+        __m128i color_low = _mm_shuffle_epi8(palette_low, index);
+        __m128i color_high = _mm_shuffle_epi8(palette_high, index);
+        __m128i is_high = _mm_cmpeq_epi8(_mm_and_si128(index, high_half), high_half);
+        __m128i color = _mm_or_si128(_mm_and_si128(is_high, color_high), _mm_andnot_si128(is_high, color_low));
+        _mm_storeu_si128((__m128i*) (out + x), color);
+#else
+        // plain SSE2 has no byte shuffle, the lookup stays scalar
+        uint8_t indices[16];
+        _mm_storeu_si128((__m128i*) indices, index);
+        for (int i = 0; i < 16; i++) {
+            out[x + i] = palette[indices[i]];
+        }
+#endif
+    }
+#endif
+    
+    for (; x < count; x++) {
+        out[x] = compose_pixel(background[x], sprites[x], palette);
+    }
+}
+
+void compose_expand(const uint8_t* colors, const uint32_t* lut, uint32_t* out, int count) {
+    int x = 0;
+    
+#if defined(COMPOSE_AVX2)
+    const __m256i color_mask = _mm256_set1_epi32(0x3f);
+    
+    for (; x + 8 <= count; x += 8) {
+        __m128i packed = _mm_loadl_epi64((const __m128i*) (colors + x));
+        __m256i index = _mm256_and_si256(_mm256_cvtepu8_epi32(packed), color_mask);
+        __m256i pixels = _mm256_i32gather_epi32((const int*) lut, index, 4);
+        _mm256_storeu_si256((__m256i*) (out + x), pixels);
+    }
+#endif
+    
+    for (; x + 4 <= count; x += 4) {
+        out[x] = lut[colors[x] & 0x3f];
+        out[x + 1] = lut[colors[x + 1] & 0x3f];
+        out[x + 2] = lut[colors[x + 2] & 0x3f];
+        out[x + 3] = lut[colors[x + 3] & 0x3f];
+    }
+    for (; x < count; x++) {
+        out[x] = lut[colors[x] & 0x3f];
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef compose_hpp
+#define compose_hpp
+
+#include <cstdint>
+
+// Scanline compositing for the scanline renderer. Background and sprite lines
+// hold one palette index per pixel, 0 where the pixel is transparent. Sprite
+// pixels carry COMPOSE_BEHIND when they sit behind the background.
+//
+// Built for AVX2 or SSE2 (with SSSE3 for the palette lookup) when the compiler
+// targets them, scalar otherwise. COMPOSE_SCALAR forces the scalar version.
+
+#define COMPOSE_BEHIND  0x80
+
+// chunky tile rows and their attribute palettes to a line of indices, 8 per tile
+void compose_tiles(const uint16_t* rows, const uint8_t* sets, int tiles, uint8_t* line);
+
+// sprite over or under background, then through the 32 palette entries
+void compose_line(const uint8_t* background, const uint8_t* sprites, const uint8_t* palette, uint8_t* out, int count);
+
+// 6 bit colours to 32 bit pixels through a 64 entry table
+void compose_expand(const uint8_t* colors, const uint32_t* lut, uint32_t* out, int count);
+
+#endif
@@ -77,6 +77,14 @@ uint16_t CPU::execute() {
         
         reg_pc = memory->nmi_vector();
         cycles += 2;
+    } else if (memory->read_irq() && !get_interrupt()) {
+        // irq is level triggered, the source holds it until acknowledged
+        push16(reg_pc);
+        push((reg_p & 0xef) | 0x20);
+        set_interrupt(1);
+        
+        reg_pc = memory->irq_vector();
+        cycles += 2;
     }
     
     uint8_t opcode = pc_read();
@@ -0,0 +1,232 @@
+#include "debugview.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+DebugView::DebugView(const uint32_t* colors) {
+    std::copy(colors, colors + 64, this->colors.begin());
+    pixels.assign(DEBUG_WIDTH * DEBUG_HEIGHT, DEBUG_BLANK);
+
+    window = SDL_CreateWindow("VRAM", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, DEBUG_WIDTH, DEBUG_HEIGHT, SDL_WINDOW_SHOWN);
+    if (window == NULL) {
+        throw std::runtime_error(SDL_GetError());
+    }
+    renderer = SDL_CreateRenderer(window, -1, 0);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, DEBUG_WIDTH, DEBUG_HEIGHT);
+
+    thread = std::thread(&DebugView::loop, this);
+}
+
+DebugView::~DebugView() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    wake.notify_one();
+    thread.join();
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+}
+
+bool DebugView::wants_snapshot() {
+    std::lock_guard<std::mutex> guard(lock);
+    return taken == pending.version && !finished;
+}
+
+void DebugView::publish(const DebugSnapshot& snapshot) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        uint64_t version = pending.version + 1;
+        pending = snapshot;
+        pending.version = version;
+    }
+    wake.notify_one();
+}
+
+void DebugView::present() {
+    {
+        // the viewer thread is waiting while finished is set, so pixels can
+        // be read without a copy
+        std::lock_guard<std::mutex> guard(lock);
+        if (!finished) {
+            return;
+        }
+        SDL_UpdateTexture(texture, NULL, pixels.data(), DEBUG_WIDTH * sizeof(uint32_t));
+        finished = false;
+    }
+
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
+
+uint32_t DebugView::get_window_id() {
+    return SDL_GetWindowID(window);
+}
+
+// viewer thread
+
+void DebugView::loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return !running || taken != pending.version; });
+            if (!running) {
+                break;
+            }
+            next = pending;
+            taken = pending.version;
+        }
+
+        update();
+
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+    }
+}
+
+void DebugView::update() {
+    // every tile uses the palettes, and a different table or sprite size
+    // moves every tile the views point at
+    bool full = !drawn || next.palette != shown.palette;
+    bool tables = full || ((next.ctrl ^ shown.ctrl) & 0x10);
+    bool sprites = full || ((next.ctrl ^ shown.ctrl) & 0x28);
+
+    for (int tile = 0; tile < DEBUG_TILES; tile++) {
+        chr_dirty[tile] = full || std::memcmp(next.chr.data() + tile * DEBUG_TILE, shown.chr.data() + tile * DEBUG_TILE, DEBUG_TILE) != 0;
+    }
+
+    draw_pattern_tables(full);
+    draw_nametables(tables);
+    draw_oam(sprites);
+    if (full) {
+        draw_palettes();
+    }
+
+    std::swap(shown, next);
+    drawn = true;
+}
+
+void DebugView::draw_tile(const uint8_t* tile, const uint32_t* palette, int x, int y, bool flip_x, bool flip_y) {
+    for (int row = 0; row < 8; row++) {
+        uint8_t low = tile[flip_y ? 7 - row : row];
+        uint8_t high = tile[(flip_y ? 7 - row : row) + 8];
+        uint32_t* out = pixels.data() + (y + row) * DEBUG_WIDTH + x;
+
+        for (int column = 0; column < 8; column++) {
+            int bit = flip_x ? column : 7 - column;
+            out[column] = palette[((low >> bit) & 1) | (((high >> bit) & 1) << 1)];
+        }
+    }
+}
+
+void DebugView::fill(int x, int y, int width, int height, uint32_t color) {
+    for (int row = y; row < y + height; row++) {
+        std::fill(pixels.begin() + row * DEBUG_WIDTH + x, pixels.begin() + row * DEBUG_WIDTH + x + width, color);
+    }
+}
+
+void DebugView::draw_nametables(bool full) {
+    // the four background palettes, each sharing the backdrop
+    std::array<std::array<uint32_t, 4>, 4> palettes;
+    for (int set = 0; set < 4; set++) {
+        palettes[set][0] = colors[next.palette[0] & 0x3f];
+        for (int i = 1; i < 4; i++) {
+            palettes[set][i] = colors[next.palette[set * 4 + i] & 0x3f];
+        }
+    }
+
+    int table = (next.ctrl & 0x10) ? 256 : 0;
+
+    for (int nt = 0; nt < 4; nt++) {
+        const uint8_t* cells = next.nametables.data() + nt * DEBUG_NAMETABLE;
+        const uint8_t* old_cells = shown.nametables.data() + nt * DEBUG_NAMETABLE;
+        int left = (nt & 1) * 256;
+        int top = (nt >> 1) * 240;
+
+        for (int cell = 0; cell < DEBUG_CELLS; cell++) {
+            int column = cell & 0x1f;
+            int row = cell >> 5;
+            int attribute = DEBUG_CELLS + (row >> 2) * 8 + (column >> 2);
+
+            uint8_t tile = cells[cell];
+            if (!full && tile == old_cells[cell] && cells[attribute] == old_cells[attribute] && !chr_dirty[table + tile]) {
+                continue;
+            }
+
+            uint8_t shift = ((row & 2) << 1) | (column & 2);
+            uint8_t set = (cells[attribute] >> shift) & 0x3;
+            draw_tile(next.chr.data() + (table + tile) * DEBUG_TILE, palettes[set].data(), left + column * 8, top + row * 8, false, false);
+        }
+    }
+}
+
+void DebugView::draw_pattern_tables(bool full) {
+    // shown with the first background palette
+    std::array<uint32_t, 4> palette;
+    for (int i = 0; i < 4; i++) {
+        palette[i] = colors[next.palette[i] & 0x3f];
+    }
+
+    for (int tile = 0; tile < DEBUG_TILES; tile++) {
+        if (!full && !chr_dirty[tile]) {
+            continue;
+        }
+        int x = DEBUG_PANEL_X + (tile >> 8) * 128 + (tile & 0xf) * 8;
+        int y = DEBUG_PT_Y + ((tile >> 4) & 0xf) * 8;
+        draw_tile(next.chr.data() + tile * DEBUG_TILE, palette.data(), x, y, false, false);
+    }
+}
+
+void DebugView::draw_oam(bool full) {
+    bool tall = next.ctrl & 0x20;
+    int table = (next.ctrl & 0x08) ? 256 : 0;
+
+    // 16 sprites to a row, each in a 16x16 cell
+    for (int sprite = 0; sprite < 64; sprite++) {
+        const uint8_t* entry = next.oam.data() + sprite * 4;
+        uint8_t index = entry[1];
+        uint8_t attributes = entry[2];
+
+        // the tiles on top and underneath, the same one for 8x8 sprites
+        int top = tall ? ((index & 1) << 8) + (index & 0xfe) : table + index;
+        int bottom = tall ? top + 1 : top;
+
+        bool changed = std::memcmp(entry, shown.oam.data() + sprite * 4, 4) != 0;
+        if (!full && !changed && !chr_dirty[top] && !chr_dirty[bottom]) {
+            continue;
+        }
+
+        std::array<uint32_t, 4> palette;
+        palette[0] = DEBUG_BLANK;
+        for (int i = 1; i < 4; i++) {
+            palette[i] = colors[next.palette[0x10 + (attributes & 0x3) * 4 + i] & 0x3f];
+        }
+
+        bool flip_x = attributes & 0x40;
+        bool flip_y = attributes & 0x80;
+        int x = DEBUG_PANEL_X + (sprite & 0xf) * 16;
+        int y = DEBUG_OAM_Y + (sprite >> 4) * 16;
+
+        fill(x, y, 16, 16, DEBUG_BLANK);
+        if (tall) {
+            // flipping an 8x16 sprite swaps its two tiles as well
+            draw_tile(next.chr.data() + (flip_y ? bottom : top) * DEBUG_TILE, palette.data(), x + 4, y, flip_x, flip_y);
+            draw_tile(next.chr.data() + (flip_y ? top : bottom) * DEBUG_TILE, palette.data(), x + 4, y + 8, flip_x, flip_y);
+        } else {
+            draw_tile(next.chr.data() + top * DEBUG_TILE, palette.data(), x + 4, y + 4, flip_x, flip_y);
+        }
+    }
+}
+
+void DebugView::draw_palettes() {
+    // background then sprite palettes, 16 to a row
+    for (int i = 0; i < DEBUG_PALETTE; i++) {
+        int x = DEBUG_PANEL_X + (i & 0xf) * 16;
+        int y = DEBUG_PALETTE_Y + (i >> 4) * 16;
+        fill(x, y, 16, 16, colors[next.palette[i] & 0x3f]);
+    }
+}
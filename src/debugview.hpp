@@ -0,0 +1,107 @@
+#ifndef debugview_hpp
+#define debugview_hpp
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <SDL.h>
+
+// Live VRAM viewer. Once a frame the emulation thread hands over a copy of
+// the nametables, chr, oam and palettes if the viewer is ready for one, and
+// a thread of its own draws them into a pixel buffer. Only tiles whose bytes
+// changed since the snapshot it drew last are redrawn. SDL wants windows
+// driven from the main thread, so the window is made, updated and presented
+// there, from present(), once the drawing thread has finished a buffer.
+
+// the four nametables on the left, everything else down the right
+#define DEBUG_NT_WIDTH      512
+#define DEBUG_NT_HEIGHT     480
+#define DEBUG_WIDTH         768
+#define DEBUG_HEIGHT        480
+
+#define DEBUG_PANEL_X       512
+#define DEBUG_PT_Y          0
+#define DEBUG_OAM_Y         136
+#define DEBUG_PALETTE_Y     208
+
+#define DEBUG_BLANK         0xFF202020
+
+// snapshot sizes
+#define DEBUG_NAMETABLE     0x400
+#define DEBUG_CELLS         960
+#define DEBUG_CHR           0x2000
+#define DEBUG_TILES         512
+#define DEBUG_TILE          16
+#define DEBUG_OAM           0x100
+#define DEBUG_PALETTE       32
+
+struct DebugSnapshot {
+    // counts up with every snapshot handed over
+    uint64_t version = 0;
+
+    std::array<uint8_t, DEBUG_NAMETABLE * 4> nametables = {};
+    std::array<uint8_t, DEBUG_CHR> chr = {};
+    std::array<uint8_t, DEBUG_OAM> oam = {};
+    std::array<uint8_t, DEBUG_PALETTE> palette = {};
+
+    // PPUCTRL, for the pattern tables and sprite size in use
+    uint8_t ctrl = 0;
+};
+
+class DebugView {
+private:
+    // ARGB for each of the 64 colours
+    std::array<uint32_t, 64> colors;
+
+    // shared with the emulation thread
+    std::mutex lock;
+    std::condition_variable wake;
+    DebugSnapshot pending;
+    uint64_t taken = 0;
+    bool running = true;
+    // pixels holds a drawn snapshot that hasn't been presented, the viewer
+    // thread leaves it alone until it has
+    bool finished = false;
+
+    // only touched by the viewer thread
+    DebugSnapshot shown;
+    DebugSnapshot next;
+    bool drawn = false;
+    std::vector<uint32_t> pixels;
+    std::array<bool, DEBUG_TILES> chr_dirty;
+
+    // only touched by the main thread
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
+
+    std::thread thread;
+
+    void loop();
+    void update();
+
+    void draw_tile(const uint8_t* tile, const uint32_t* palette, int x, int y, bool flip_x, bool flip_y);
+    void fill(int x, int y, int width, int height, uint32_t color);
+    void draw_nametables(bool full);
+    void draw_pattern_tables(bool full);
+    void draw_oam(bool full);
+    void draw_palettes();
+
+public:
+    // colors is the 64 entry ARGB palette
+    DebugView(const uint32_t* colors);
+    ~DebugView();
+
+    // true once the last snapshot has been drawn and presented
+    bool wants_snapshot();
+    void publish(const DebugSnapshot& snapshot);
+
+    // main thread, shows the last finished buffer if there's a new one
+    void present();
+    uint32_t get_window_id();
+};
+
+#endif
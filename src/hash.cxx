@@ -0,0 +1,344 @@
+#include "hash.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+// CRC-32
+
+// The SSE4.2 crc32 instruction computes CRC-32C, which the ROM databases don't
+// use. With PCLMULQDQ the IEEE polynomial is folded 64 bytes at a time
+// instead, and the table driven version eight bytes at a time does the rest.
+#if !defined(CRC_SCALAR) && defined(__PCLMUL__) && defined(__SSE4_1__)
+#define CRC_PCLMUL
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+static std::array<std::array<uint32_t, 256>, 8> make_crc_tables() {
+    std::array<std::array<uint32_t, 256>, 8> tables;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+        }
+        tables[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t prev = tables[t - 1][i];
+            tables[t][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+
+    return tables;
+}
+
+// crc is the running value, already inverted
+static uint32_t crc32_slice(const uint8_t* data, size_t size, uint32_t crc) {
+    static const std::array<std::array<uint32_t, 256>, 8> tables = make_crc_tables();
+
+    while (size >= 8) {
+        uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24));
+        uint32_t high = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t) data[7] << 24);
+
+        crc = tables[7][low & 0xff] ^ tables[6][(low >> 8) & 0xff] ^
+              tables[5][(low >> 16) & 0xff] ^ tables[4][low >> 24] ^
+              tables[3][high & 0xff] ^ tables[2][(high >> 8) & 0xff] ^
+              tables[1][(high >> 16) & 0xff] ^ tables[0][high >> 24];
+
+        data += 8;
+        size -= 8;
+    }
+
+    while (size--) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xff];
+    }
+
+    return crc;
+}
+
+#ifdef CRC_PCLMUL
+// Carry-less multiplication folding (Intel, "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ"), bit reflected. size is at least 64 and a
+// multiple of 16, crc is the running value, already inverted
+static uint32_t crc32_fold(const uint8_t* data, size_t size, uint32_t crc) {
+    // x^(4*128+32) and x^(4*128-32) mod P, then the same for 128, for 64, and
+    // the Barrett constants floor(x^64 / P) and P
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i*) (data + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i*) (data + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i*) (data + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i*) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    data += 64;
+    size -= 64;
+
+    // four lanes 64 bytes apart
+    while (size >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*) (data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*) (data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*) (data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*) (data + 0x30)));
+
+        data += 64;
+        size -= 64;
+    }
+
+    // the lanes into one, then whatever 16 byte blocks are left
+    __m128i lanes[3] = {x2, x3, x4};
+    for (__m128i next : lanes) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+    }
+
+    while (size >= 16) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*) data)), x5);
+        data += 16;
+        size -= 16;
+    }
+
+    // 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+uint32_t crc32_ieee(const uint8_t* data, size_t size, uint32_t crc) {
+    crc = ~crc;
+
+#ifdef CRC_PCLMUL
+    if (size >= 64) {
+        size_t bulk = size & ~(size_t) 15;
+        crc = crc32_fold(data, bulk, crc);
+        data += bulk;
+        size -= bulk;
+    }
+#endif
+
+    return ~crc32_slice(data, size, crc);
+}
+
+// 64-bit hash
+
+#define ROL64(value, bits) (((value) << (bits)) | ((value) >> (64 - (bits))))
+
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+#define PRIME64_4 0x85ebca77c2b2ae63ULL
+#define PRIME64_5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t read64(const uint8_t* data) {
+    uint64_t value;
+    std::memcpy(&value, data, 8);
+    return value;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t word) {
+    acc += word * PRIME64_2;
+    return ROL64(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t hash_merge(uint64_t hash, uint64_t acc) {
+    hash ^= hash_round(0, acc);
+    return hash * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t hash64(const uint8_t* data, size_t size, uint64_t seed) {
+    const uint8_t* end = data + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        // four independent lanes so the multiplies overlap
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        while (data + 32 <= end) {
+            v1 = hash_round(v1, read64(data));
+            v2 = hash_round(v2, read64(data + 8));
+            v3 = hash_round(v3, read64(data + 16));
+            v4 = hash_round(v4, read64(data + 24));
+            data += 32;
+        }
+
+        hash = ROL64(v1, 1) + ROL64(v2, 7) + ROL64(v3, 12) + ROL64(v4, 18);
+        hash = hash_merge(hash, v1);
+        hash = hash_merge(hash, v2);
+        hash = hash_merge(hash, v3);
+        hash = hash_merge(hash, v4);
+    } else {
+        hash = seed + PRIME64_5;
+    }
+
+    hash += size;
+
+    while (data + 8 <= end) {
+        hash ^= hash_round(0, read64(data));
+        hash = ROL64(hash, 27) * PRIME64_1 + PRIME64_4;
+        data += 8;
+    }
+
+    while (data < end) {
+        hash ^= *data++ * PRIME64_5;
+        hash = ROL64(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// SHA-1
+
+#define ROL32(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+SHA1::SHA1() {
+    state = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    length = 0;
+    used = 0;
+}
+
+void SHA1::compress(const uint8_t* data) {
+    std::array<uint32_t, 80> w;
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t) data[i * 4] << 24) | (data[i * 4 + 1] << 16) | (data[i * 4 + 2] << 8) | data[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+
+        uint32_t temp = ROL32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL32(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void SHA1::update(const uint8_t* data, size_t size) {
+    length += size;
+
+    if (used) {
+        size_t take = std::min(size, SHA1_BLOCK - used);
+        std::memcpy(block.data() + used, data, take);
+        used += take;
+        data += take;
+        size -= take;
+
+        if (used < SHA1_BLOCK) {
+            return;
+        }
+        compress(block.data());
+        used = 0;
+    }
+
+    // whole blocks straight from the caller's buffer
+    while (size >= SHA1_BLOCK) {
+        compress(data);
+        data += SHA1_BLOCK;
+        size -= SHA1_BLOCK;
+    }
+
+    std::memcpy(block.data(), data, size);
+    used = size;
+}
+
+std::array<uint8_t, SHA1_SIZE> SHA1::digest() {
+    uint64_t bits = length * 8;
+
+    block[used++] = 0x80;
+    if (used > SHA1_BLOCK - 8) {
+        std::memset(block.data() + used, 0, SHA1_BLOCK - used);
+        compress(block.data());
+        used = 0;
+    }
+    std::memset(block.data() + used, 0, SHA1_BLOCK - 8 - used);
+    for (int i = 0; i < 8; i++) {
+        block[SHA1_BLOCK - 1 - i] = bits >> (i * 8);
+    }
+    compress(block.data());
+
+    std::array<uint8_t, SHA1_SIZE> out;
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        out[i] = state[i / 4] >> (24 - (i % 4) * 8);
+    }
+    return out;
+}
+
+std::string to_hex(const uint8_t* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+
+    std::string out;
+    out.reserve(size * 2);
+    for (size_t i = 0; i < size; i++) {
+        out.push_back(digits[data[i] >> 4]);
+        out.push_back(digits[data[i] & 0xf]);
+    }
+    return out;
+}
@@ -0,0 +1,36 @@
+#ifndef hash_hpp
+#define hash_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <string>
+
+#define SHA1_SIZE   20
+#define SHA1_BLOCK  64
+
+// CRC-32 (IEEE, as used by the ROM databases), PCLMULQDQ folding where the
+// build targets it, slicing-by-8 otherwise
+uint32_t crc32_ieee(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+// 64-bit non-cryptographic hash after xxHash64 for comparing frames
+uint64_t hash64(const uint8_t* data, size_t size, uint64_t seed = 0);
+
+class SHA1 {
+private:
+    std::array<uint32_t, 5> state;
+    std::array<uint8_t, SHA1_BLOCK> block;
+    uint64_t length;
+    size_t used;
+
+    void compress(const uint8_t* data);
+
+public:
+    SHA1();
+    void update(const uint8_t* data, size_t size);
+    std::array<uint8_t, SHA1_SIZE> digest();
+};
+
+std::string to_hex(const uint8_t* data, size_t size);
+
+#endif
@@ -2,12 +2,50 @@
 #include <SDL2/SDL.h>
 #include <memory>
 #include <iomanip>
+#include <string>
 
 #include "nes.hpp"
+#include "regress.hpp"
 
 int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " rom [--scanline] [--ntsc] [--capture file]" << std::endl;
+        std::cerr << "       " << argv[0] << " --regress manifest [--update] [--dump dir]" << std::endl;
+        return 1;
+    }
     const char* filename = argv[1];
+    
+    // --regress manifest [--update] [--dump dir] runs headless and exits
+    if (std::string(filename) == "--regress" && argc > 2) {
+        const char* dump_dir = nullptr;
+        bool update = false;
+        for (int i = 3; i < argc; i++) {
+            std::string option = argv[i];
+            if (option == "--update") {
+                update = true;
+            } else if (option == "--dump" && i + 1 < argc) {
+                dump_dir = argv[++i];
+            }
+        }
+        return regress(argv[2], dump_dir, update) == 0 ? 0 : 1;
+    }
+    
     auto nes = std::make_shared<NES>(filename);
+    
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        
+        // --scanline draws whole lines at once where nothing watches mid-line
+        if (option == "--scanline") {
+            nes->set_render_mode(RENDER_SCANLINE);
+        } else if (option == "--ntsc") {
+            nes->set_ntsc(true);
+        } else if (option == "--capture" && i + 1 < argc) {
+            // .y4m, .rgb, or anything else for raw palette indices
+            std::string filename = argv[++i];
+            nes->start_capture(filename.c_str(), capture_format(filename));
+        }
+    }
     nes->run();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,308 @@
+#include "mapper.hpp"
+#include "mem.hpp"
+
+Mapper::Mapper(Mem* memory, std::shared_ptr<ROM> rom, const uint8_t* chr, uint32_t chr_size) {
+    this->memory = memory;
+    this->rom = rom;
+    this->prg = rom->get_prg_data();
+    this->prg_size = rom->get_prg_size();
+    this->chr = chr;
+    this->chr_size = chr_size;
+}
+
+Mapper::~Mapper() {
+}
+
+std::shared_ptr<Mapper> Mapper::create(Mem* memory, std::shared_ptr<ROM> rom, const uint8_t* chr, uint32_t chr_size) {
+    std::shared_ptr<Mapper> mapper;
+
+    switch (rom->get_mapper()) {
+        case MAPPER_NROM: {
+            mapper = std::make_shared<NROM>(memory, rom, chr, chr_size);
+            break;
+        }
+        case MAPPER_MMC1: {
+            mapper = std::make_shared<MMC1>(memory, rom, chr, chr_size);
+            break;
+        }
+        case MAPPER_UXROM: {
+            mapper = std::make_shared<UxROM>(memory, rom, chr, chr_size);
+            break;
+        }
+        case MAPPER_CNROM: {
+            mapper = std::make_shared<CNROM>(memory, rom, chr, chr_size);
+            break;
+        }
+        case MAPPER_MMC3: {
+            mapper = std::make_shared<MMC3>(memory, rom, chr, chr_size);
+            break;
+        }
+        default: {
+            throw bad_mapper();
+        }
+    }
+
+    mapper->reset();
+    return mapper;
+}
+
+void Mapper::reset() {
+    prg_32k(0);
+    chr_8k(0);
+    set_mirroring(rom->get_mirroring());
+}
+
+void Mapper::write(uint16_t, uint8_t) {
+    // no registers
+}
+
+void Mapper::a12_rise() {
+    // no scanline counter
+}
+
+// bank switching
+
+void Mapper::prg_8k(uint8_t slot, int32_t bank) {
+    int32_t count = prg_size / PRG_BANK;
+    bank = ((bank % count) + count) % count;
+    memory->set_prg_bank(slot, prg + bank * PRG_BANK);
+}
+
+void Mapper::prg_16k(uint8_t slot, int32_t bank) {
+    if (bank < 0) {
+        int32_t count = prg_size / (PRG_BANK * 2);
+        bank += count;
+    }
+    prg_8k(slot * 2, bank * 2);
+    prg_8k(slot * 2 + 1, bank * 2 + 1);
+}
+
+void Mapper::prg_32k(int32_t bank) {
+    prg_16k(0, bank * 2);
+    prg_16k(1, bank * 2 + 1);
+}
+
+void Mapper::chr_1k(uint8_t slot, int32_t bank) {
+    int32_t count = chr_size / CHR_BANK;
+    bank = ((bank % count) + count) % count;
+    memory->set_chr_bank(slot, chr + bank * CHR_BANK);
+}
+
+void Mapper::chr_2k(uint8_t slot, int32_t bank) {
+    chr_1k(slot * 2, bank * 2);
+    chr_1k(slot * 2 + 1, bank * 2 + 1);
+}
+
+void Mapper::chr_4k(uint8_t slot, int32_t bank) {
+    chr_2k(slot * 2, bank * 2);
+    chr_2k(slot * 2 + 1, bank * 2 + 1);
+}
+
+void Mapper::chr_8k(int32_t bank) {
+    chr_4k(0, bank * 2);
+    chr_4k(1, bank * 2 + 1);
+}
+
+void Mapper::set_mirroring(uint8_t mode) {
+    memory->set_mirroring(mode);
+}
+
+// MMC1
+
+void MMC1::reset() {
+    shift = 0;
+    shift_count = 0;
+    control = 0x0c;
+    chr_bank_0 = 0;
+    chr_bank_1 = 0;
+    prg_bank = 0;
+    update_banks();
+}
+
+void MMC1::write(uint16_t index, uint8_t value) {
+    // bit 7 clears the shift register and locks the last prg bank at $C000
+    if (value & 0x80) {
+        shift = 0;
+        shift_count = 0;
+        control |= 0x0c;
+        update_banks();
+        return;
+    }
+
+    shift |= (value & 1) << shift_count;
+    shift_count++;
+
+    if (shift_count < 5) {
+        return;
+    }
+
+    // the fifth write picks the register with bits 13-14 of the address
+    switch ((index >> 13) & 0x3) {
+        case 0: {
+            control = shift;
+            break;
+        }
+        case 1: {
+            chr_bank_0 = shift;
+            break;
+        }
+        case 2: {
+            chr_bank_1 = shift;
+            break;
+        }
+        case 3: {
+            prg_bank = shift & 0xf;
+            break;
+        }
+    }
+
+    shift = 0;
+    shift_count = 0;
+    update_banks();
+}
+
+void MMC1::update_banks() {
+    switch (control & 0x3) {
+        case 0: {
+            set_mirroring(MIRROR_SINGLE_LOW);
+            break;
+        }
+        case 1: {
+            set_mirroring(MIRROR_SINGLE_HIGH);
+            break;
+        }
+        case 2: {
+            set_mirroring(MIRROR_VERTICAL);
+            break;
+        }
+        case 3: {
+            set_mirroring(MIRROR_HORIZONTAL);
+            break;
+        }
+    }
+
+    switch ((control >> 2) & 0x3) {
+        case 0:
+        case 1: {
+            prg_32k(prg_bank >> 1);
+            break;
+        }
+        case 2: {
+            prg_16k(0, 0);
+            prg_16k(1, prg_bank);
+            break;
+        }
+        case 3: {
+            prg_16k(0, prg_bank);
+            prg_16k(1, -1);
+            break;
+        }
+    }
+
+    if (control & 0x10) {
+        chr_4k(0, chr_bank_0);
+        chr_4k(1, chr_bank_1);
+    } else {
+        chr_8k(chr_bank_0 >> 1);
+    }
+}
+
+// UxROM
+
+void UxROM::reset() {
+    Mapper::reset();
+    prg_16k(0, 0);
+    prg_16k(1, -1);
+}
+
+void UxROM::write(uint16_t, uint8_t value) {
+    prg_16k(0, value);
+}
+
+// CNROM
+
+void CNROM::write(uint16_t, uint8_t value) {
+    chr_8k(value & 0x3);
+}
+
+// MMC3
+
+void MMC3::reset() {
+    Mapper::reset();
+    bank_select = 0;
+    bank_regs = {0, 2, 4, 5, 6, 7, 0, 1};
+    irq_latch = 0;
+    irq_counter = 0;
+    irq_reload = false;
+    irq_enabled = false;
+    update_banks();
+}
+
+void MMC3::write(uint16_t index, uint8_t value) {
+    bool odd = index & 1;
+
+    switch (index & 0xe000) {
+        case 0x8000: {
+            if (odd) bank_regs[bank_select & 0x7] = value;
+            else bank_select = value;
+            update_banks();
+            break;
+        }
+        case 0xa000: {
+            // odd writes protect prg ram, which is always enabled here
+            if (!odd && rom->get_mirroring() != MIRROR_FOUR) {
+                set_mirroring((value & 1) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL);
+            }
+            break;
+        }
+        case 0xc000: {
+            if (odd) irq_reload = true;
+            else irq_latch = value;
+            break;
+        }
+        case 0xe000: {
+            // disabling also acknowledges a pending irq
+            irq_enabled = odd;
+            if (!odd) memory->set_irq(false);
+            break;
+        }
+    }
+}
+
+void MMC3::a12_rise() {
+    if (irq_counter == 0 || irq_reload) {
+        irq_counter = irq_latch;
+        irq_reload = false;
+    } else {
+        irq_counter--;
+    }
+    
+    if (irq_counter == 0 && irq_enabled) {
+        memory->set_irq(true);
+    }
+}
+
+void MMC3::update_banks() {
+    // bit 7 swaps the 2 KB and 1 KB chr halves
+    uint8_t inv = (bank_select & 0x80) ? 4 : 0;
+
+    chr_1k(0 ^ inv, bank_regs[0] & 0xfe);
+    chr_1k(1 ^ inv, bank_regs[0] | 0x01);
+    chr_1k(2 ^ inv, bank_regs[1] & 0xfe);
+    chr_1k(3 ^ inv, bank_regs[1] | 0x01);
+    chr_1k(4 ^ inv, bank_regs[2]);
+    chr_1k(5 ^ inv, bank_regs[3]);
+    chr_1k(6 ^ inv, bank_regs[4]);
+    chr_1k(7 ^ inv, bank_regs[5]);
+
+    // bit 6 swaps which of $8000 and $C000 is fixed to the second last bank
+    if (bank_select & 0x40) {
+        prg_8k(0, -2);
+        prg_8k(2, bank_regs[6]);
+    } else {
+        prg_8k(0, bank_regs[6]);
+        prg_8k(2, -2);
+    }
+    prg_8k(1, bank_regs[7]);
+    prg_8k(3, -1);
+}
@@ -0,0 +1,134 @@
+#ifndef mapper_hpp
+#define mapper_hpp
+
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <exception>
+
+#include "rom.hpp"
+
+// bank granularity of the cpu/ppu bank tables
+#define PRG_BANK        0x2000
+#define CHR_BANK        0x400
+#define PRG_SLOTS       4
+#define CHR_SLOTS       8
+
+// nametable mirroring
+#define MIRROR_HORIZONTAL   0
+#define MIRROR_VERTICAL     1
+#define MIRROR_SINGLE_LOW   2
+#define MIRROR_SINGLE_HIGH  3
+#define MIRROR_FOUR         4
+
+// mapper numbers
+#define MAPPER_NROM     0
+#define MAPPER_MMC1     1
+#define MAPPER_UXROM    2
+#define MAPPER_CNROM    3
+#define MAPPER_MMC3     4
+
+class Mem;
+
+// A mapper never serves reads. It only rewrites the bank pointer tables held by
+// Mem when the cpu writes to one of its registers ($8000-$FFFF), so the read
+// path stays a plain table lookup.
+class Mapper {
+protected:
+    Mem* memory;
+    std::shared_ptr<ROM> rom;
+
+    const uint8_t* prg;
+    uint32_t prg_size;
+    const uint8_t* chr;
+    uint32_t chr_size;
+
+    // bank switching, negative banks count from the end
+    void prg_8k(uint8_t slot, int32_t bank);
+    void prg_16k(uint8_t slot, int32_t bank);
+    void prg_32k(int32_t bank);
+    void chr_1k(uint8_t slot, int32_t bank);
+    void chr_2k(uint8_t slot, int32_t bank);
+    void chr_4k(uint8_t slot, int32_t bank);
+    void chr_8k(int32_t bank);
+    void set_mirroring(uint8_t mode);
+
+public:
+    Mapper(Mem* memory, std::shared_ptr<ROM> rom, const uint8_t* chr, uint32_t chr_size);
+    virtual ~Mapper();
+
+    static std::shared_ptr<Mapper> create(Mem* memory, std::shared_ptr<ROM> rom, const uint8_t* chr, uint32_t chr_size);
+
+    virtual void reset();
+    virtual void write(uint16_t index, uint8_t value);
+    
+    // called by the ppu on a filtered rising edge of PPU A12, about once per scanline
+    virtual void a12_rise();
+};
+
+// mapper 0
+class NROM : public Mapper {
+public:
+    using Mapper::Mapper;
+};
+
+// mapper 1
+class MMC1 : public Mapper {
+private:
+    uint8_t shift;
+    uint8_t shift_count;
+    uint8_t control;
+    uint8_t chr_bank_0;
+    uint8_t chr_bank_1;
+    uint8_t prg_bank;
+
+    void update_banks();
+
+public:
+    using Mapper::Mapper;
+    void reset() override;
+    void write(uint16_t index, uint8_t value) override;
+};
+
+// mapper 2
+class UxROM : public Mapper {
+public:
+    using Mapper::Mapper;
+    void reset() override;
+    void write(uint16_t index, uint8_t value) override;
+};
+
+// mapper 3
+class CNROM : public Mapper {
+public:
+    using Mapper::Mapper;
+    void write(uint16_t index, uint8_t value) override;
+};
+
+// mapper 4
+class MMC3 : public Mapper {
+private:
+    uint8_t bank_select;
+    std::array<uint8_t, 8> bank_regs;
+
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+
+    void update_banks();
+
+public:
+    using Mapper::Mapper;
+    void reset() override;
+    void write(uint16_t index, uint8_t value) override;
+    void a12_rise() override;
+};
+
+struct bad_mapper : public std::exception {
+    const char* what () const throw () {
+        return "unsupported mapper";
+    }
+};
+
+#endif
@@ -1,31 +1,33 @@
 #include "mem.hpp"
 
 Mem::Mem(std::shared_ptr<ROM> game) {
-    if (game->get_mapper() == 0) {
-        uint64_t prg_size = game->get_prg_size();
-        //std::cout << "Memory mapper 0" << std::endl << "CHR size: " << size << " bytes" << std::endl;
-        if (prg_size == NROM_128) {
-            for (int i = 0; i < NROM_128; i++) {
-                uint8_t byte = game->get_prg(i);
-                prg_rom[i] = byte;
-                prg_rom[NROM_128+i] = byte;
-            }
-        } else {
-            for (int i = 0; i < NROM_256; i++) {
-                uint8_t byte = game->get_prg(i);
-                prg_rom[i] = byte;
-            }
-        }
-        
-        uint64_t chr_size = game->get_chr_size();
-        
-        for (int i = 0; i < PATTERN_TABLE; i++) {
-            left[i] = game->get_chr(i);
-            right[i] = game->get_chr(i + PATTERN_TABLE);
-        }
-        
-        std::cout << "PRG:" << prg_size << " " << "CHR:" << chr_size << std::endl;
+    uint64_t prg_size = game->get_prg_size();
+    uint64_t chr_size = game->get_chr_size();
+    
+    const uint8_t* chr = game->get_chr_data();
+    chr_rows_base = game->get_chr_rows();
+    chr_rows_flipped_base = game->get_chr_rows_flipped();
+    chr_writable = false;
+    
+    // boards without CHR ROM carry 8 KB of CHR RAM instead
+    if (chr_size == 0) {
+        chr_ram.resize(CHR_RAM);
+        chr_ram_rows.resize(CHR_ROWS(CHR_RAM));
+        chr_ram_rows_flipped.resize(CHR_ROWS(CHR_RAM));
+        chr = chr_ram.data();
+        chr_rows_base = chr_ram_rows.data();
+        chr_rows_flipped_base = chr_ram_rows_flipped.data();
+        chr_size = CHR_RAM;
+        chr_writable = true;
     }
+    chr_base = chr;
+    
+    // $6000-$7FFF holds at most 8 KB, smaller RAM is mirrored through it
+    prg_ram.resize(std::min<uint64_t>(game->get_prg_ram_size(), PRG_RAM));
+    
+    mapper = Mapper::create(this, game, chr, chr_size);
+    
+    std::cout << "Mapper:" << game->get_mapper() << " " << "PRG:" << prg_size << " " << "CHR:" << chr_size << std::endl;
     
     strobe = true;
 }
@@ -42,6 +44,44 @@ void Mem::set_apu(std::shared_ptr<APU> apu) {
     this->apu = apu;
 }
 
+void Mem::set_prg_bank(uint8_t slot, const uint8_t* bank) {
+    prg_banks[slot] = bank;
+}
+
+void Mem::set_chr_bank(uint8_t slot, const uint8_t* bank) {
+    chr_banks[slot] = bank;
+    
+    // a 1 KB bank starts on a tile boundary, so its rows start at offset / 2
+    uint64_t offset = bank - chr_base;
+    chr_row_banks[slot] = chr_rows_base + CHR_ROWS(offset);
+    chr_row_flipped_banks[slot] = chr_rows_flipped_base + CHR_ROWS(offset);
+}
+
+void Mem::set_mirroring(uint8_t mode) {
+    switch (mode) {
+        case MIRROR_HORIZONTAL: {
+            nametable_banks = {nametables[0].data(), nametables[0].data(), nametables[1].data(), nametables[1].data()};
+            break;
+        }
+        case MIRROR_VERTICAL: {
+            nametable_banks = {nametables[0].data(), nametables[1].data(), nametables[0].data(), nametables[1].data()};
+            break;
+        }
+        case MIRROR_SINGLE_LOW: {
+            nametable_banks = {nametables[0].data(), nametables[0].data(), nametables[0].data(), nametables[0].data()};
+            break;
+        }
+        case MIRROR_SINGLE_HIGH: {
+            nametable_banks = {nametables[1].data(), nametables[1].data(), nametables[1].data(), nametables[1].data()};
+            break;
+        }
+        default: {
+            nametable_banks = {nametables[0].data(), nametables[1].data(), nametables[2].data(), nametables[3].data()};
+            break;
+        }
+    }
+}
+
 uint16_t Mem::reset_vector() {
     return mem_read2(RESET_VECTOR);
 }
@@ -50,6 +90,10 @@ uint16_t Mem::nmi_vector() {
     return mem_read2(NMI_VECTOR);
 }
 
+uint16_t Mem::irq_vector() {
+    return mem_read2(IRQ_VECTOR);
+}
+
 uint8_t Mem::mem_read(uint64_t index) {
     if (!VALID_CPU_INDEX(index)) {
         throw std::out_of_range("attempted to read from an invalid memory address");
@@ -60,19 +104,23 @@ uint8_t Mem::mem_read(uint64_t index) {
     } else if (VALID_PPU_INDEX(index)) {
         return ppu_reg_read(index);
     } else if (VALID_ROM_INDEX(index)) {
-        return prg_rom[ACTUAL_ROM_ADDRESS(index)];
+        return prg_banks[PRG_SLOT(index)][PRG_OFFSET(index)];
+    } else if (VALID_PRG_RAM_INDEX(index)) {
+        if (prg_ram.empty()) {
+            return 0;
+        }
+        return prg_ram[(index - PRG_RAM_START) % prg_ram.size()];
     } else if (VALID_APU_INDEX(index)) {
 	return apu_reg_read(index);
     } else if (index == JOYSTICK_1) {
-        if (reading && button < 8) {
-            return pressed[button];
-            button++;
-        } else if (reading && button >= 8) {
-            return 1;
-        } else if (strobe) {
+        // while strobe is high the shift register keeps reloading, so it's A
+        // every time; after that one button per read, then 1s
+        if (strobe) {
             return pressed[NES_A];
+        } else if (button < 8) {
+            return pressed[button++];
         } else {
-            return 0;
+            return 1;
         }
     } else {
         // placeholder
@@ -100,8 +148,16 @@ void Mem::mem_write(uint64_t index, uint8_t value) {
     } else if (VALID_APU_INDEX(index)) {
         apu_reg_write(index, value);
     } else if (index == JOYSTICK_1) {
-        reading = !(strobe && value);
-        strobe = value;
+        strobe = value & 1;
+        if (strobe) {
+            button = 0;
+        }
+    } else if (VALID_ROM_INDEX(index)) {
+        // bank switches change what the rest of the ppu's line fetches
+        ppu->catch_up();
+        mapper->write(index, value);
+    } else if (VALID_PRG_RAM_INDEX(index) && !prg_ram.empty()) {
+        prg_ram[(index - PRG_RAM_START) % prg_ram.size()] = value;
     }
 }
 
@@ -109,6 +165,10 @@ bool Mem::read_nmi() {
     return flag_nmi;
 }
 
+bool Mem::read_irq() {
+    return flag_irq;
+}
+
 // remember to actually update the PPU data
 
 uint8_t Mem::ppu_reg_read(uint64_t index) {
@@ -151,32 +211,16 @@ uint8_t Mem::ppu_read(uint64_t index) {
 
     //Now we find the corresponding area of memory the address belongs to and calculate the index to return.
 
-    if (index >= 0 && index < 0x1000) {
-	return left[index];
-    }
-
-    else if (index < 0x2000) {
-        return right[index % 0x1000];
-    }
-
-    else if (index < 0x2400) {
-        return nametables[0][index % 0x400]; 
-    }
-
-    else if (index < 0x2800) {
-        return nametables[1][index % 0x400];
-    }
-
-    else if (index < 0x2C00) {
-        return nametables[2][index % 0x400];
+    if (index >= 0 && index < 0x2000) {
+        return chr_banks[CHR_SLOT(index)][CHR_OFFSET(index)];
     }
 
     else if (index < 0x3000) {
-        return nametables[3][index % 0x400];
+        return nametable_banks[(index >> 10) & 0x3][index % 0x400];
     }
 
     else if (index >= 0x3F00 && index < 0x3F20) {
-        uint8_t palette_num = (index % 0xF) / 4;
+        uint8_t palette_num = (index % 0x10) / 4;
         uint8_t color_num = (index % 4);
         if (color_num == 0) {
             return univ_back_color;
@@ -191,7 +235,16 @@ uint8_t Mem::ppu_read(uint64_t index) {
 
 }
 
-uint8_t Mem::ppu_write(uint64_t index, uint8_t value) {
+uint16_t Mem::ppu_read_row(uint64_t index, bool flip) {
+    // index is a pattern table address, the plane bit is ignored
+    uint16_t row = CHR_ROW_INDEX(CHR_OFFSET(index));
+    if (flip) {
+        return chr_row_flipped_banks[CHR_SLOT(index)][row];
+    }
+    return chr_row_banks[CHR_SLOT(index)][row];
+}
+
+void Mem::ppu_write(uint64_t index, uint8_t value) {
     if (!VALID_PPU_MEM_INDEX(index)) {
         throw std::out_of_range("Tried to write to invalid ppu memory address!");
     }
@@ -202,18 +255,21 @@ uint8_t Mem::ppu_write(uint64_t index, uint8_t value) {
         index = 0x3F00 + (index % 0x20);	
     }
 
-    if (index < 0x1000) {
-        left[index] = value;
-    } else if (index < 0x2000) {
-        right[index % 0x1000] = value;
-    } else if (index < 0x2400) {
-        nametables[0][index % 0x400] = value;
-    } else if (index < 0x2800) {
-        nametables[1][index % 0x400] = value;
-    } else if (index < 0x2C00) {
-        nametables[2][index % 0x400] = value;
+    if (index < 0x2000) {
+        // the bank table is read-only, chr ram is written through its own buffer
+        if (chr_writable) {
+            uint64_t offset = chr_banks[CHR_SLOT(index)] - chr_ram.data() + CHR_OFFSET(index);
+            chr_ram[offset] = value;
+            
+            // redecode just the row this byte belongs to
+            uint64_t row = offset & ~0xf;
+            uint8_t low = chr_ram[row + (offset & 7)];
+            uint8_t high = chr_ram[row + (offset & 7) + 8];
+            chr_ram_rows[CHR_ROW_INDEX(offset)] = chr_decode_row(low, high);
+            chr_ram_rows_flipped[CHR_ROW_INDEX(offset)] = chr_decode_row_flipped(low, high);
+        }
     } else if (index < 0x3000) {
-        nametables[3][index % 0x400] = value;
+        nametable_banks[(index >> 10) & 0x3][index % 0x400] = value;
     } else if (index >= 0x3F00 && index < 0x3F20) {
         uint8_t palette_num = (index % 0x10) / 4;
         uint8_t color_num = (index % 4);
@@ -230,11 +286,13 @@ uint8_t Mem::ppu_write(uint64_t index, uint8_t value) {
 }
 
 std::array<uint8_t, NAMETABLE> Mem::get_nametable(uint8_t index) {
-    if (index > NAMETABLE) {
+    if (index > 3) {
         throw std::out_of_range("Tried to retrieve invalid nametable!");
     }
     
-    return nametables[index];
+    std::array<uint8_t, NAMETABLE> nametable;
+    std::copy(nametable_banks[index], nametable_banks[index] + NAMETABLE, nametable.begin());
+    return nametable;
 }
 
 std::array<uint8_t, PATTERN_TABLE> Mem::get_pattern_table(uint8_t index) {
@@ -242,8 +300,12 @@ std::array<uint8_t, PATTERN_TABLE> Mem::get_pattern_table(uint8_t index) {
         throw std::out_of_range("Tried to retrieve pattern table!");
     }
     
-    if (index) return right;
-    else return left;
+    std::array<uint8_t, PATTERN_TABLE> table;
+    for (int i = 0; i < 4; i++) {
+        const uint8_t* bank = chr_banks[index * 4 + i];
+        std::copy(bank, bank + CHR_BANK, table.begin() + i * CHR_BANK);
+    }
+    return table;
 }
 
 std::array<std::array<uint8_t, PALETTE>, 4> Mem::get_back_palettes() {
@@ -262,6 +324,14 @@ void Mem::set_nmi(bool nmi) {
     flag_nmi = nmi;
 }
 
+void Mem::set_irq(bool irq) {
+    flag_irq = irq;
+}
+
+void Mem::a12_rise() {
+    mapper->a12_rise();
+}
+
 uint8_t Mem::apu_reg_read(uint64_t index) {
     return apu->reg_read(index);
 }
@@ -4,15 +4,19 @@
 #include <iostream>
 #include <cstdint>
 #include <array>
+#include <vector>
 #include <memory>
+#include <algorithm>
 #include "rom.hpp"
+#include "mapper.hpp"
 #include "cpu.hpp"
 #include "ppu.hpp"
 #include "apu.hpp"
 
-#define NROM_128        16384
-#define NROM_256        32768
-#define NROM_START      0x8000
+#define PRG_RAM         0x2000
+#define PRG_RAM_START   0x6000
+#define PRG_ROM_START   0x8000
+#define CHR_RAM         0x2000
 
 #define CPU_MEM_SIZE    0x10000
 #define PPU_MEM_SIZE    0x3FFF
@@ -25,8 +29,13 @@
 
 #define NMI_VECTOR      0xFFFA
 #define RESET_VECTOR    0xFFFC
-#define VALID_ROM_INDEX(index) (index >= NROM_START && index < CPU_MEM_SIZE)
-#define ACTUAL_ROM_ADDRESS(index) (index - NROM_START)
+#define IRQ_VECTOR      0xFFFE
+#define VALID_ROM_INDEX(index) (index >= PRG_ROM_START && index < CPU_MEM_SIZE)
+#define VALID_PRG_RAM_INDEX(index) (index >= PRG_RAM_START && index < PRG_ROM_START)
+#define PRG_SLOT(index) ((index >> 13) & 0x3)
+#define PRG_OFFSET(index) (index & 0x1FFF)
+#define CHR_SLOT(index) ((index >> 10) & 0x7)
+#define CHR_OFFSET(index) (index & 0x3FF)
 
 // input
 
@@ -73,6 +82,7 @@
 #define FRAME_COUNTER   0x4017
 
 class ROM;
+class Mapper;
 class CPU;
 class PPU;
 class APU;
@@ -83,21 +93,37 @@ private:
     // cpu
     std::shared_ptr<CPU> cpu;
     std::array<uint8_t, RAM> ram;
-    std::array<uint8_t, CPU_MEM_SIZE - NROM_START> prg_rom;
+    // sized by the board, empty when there is none
+    std::vector<uint8_t> prg_ram;
+    
+    // cartridge, banks are switched by the mapper
+    std::shared_ptr<Mapper> mapper;
+    std::array<const uint8_t*, PRG_SLOTS> prg_banks;
+    std::array<const uint8_t*, CHR_SLOTS> chr_banks;
+    std::vector<uint8_t> chr_ram;
+    bool chr_writable;
+    
+    // decoded chr rows, banked alongside chr_banks
+    const uint8_t* chr_base;
+    const uint16_t* chr_rows_base;
+    const uint16_t* chr_rows_flipped_base;
+    std::array<const uint16_t*, CHR_SLOTS> chr_row_banks;
+    std::array<const uint16_t*, CHR_SLOTS> chr_row_flipped_banks;
+    std::vector<uint16_t> chr_ram_rows;
+    std::vector<uint16_t> chr_ram_rows_flipped;
     
     bool flag_nmi = false;
+    bool flag_irq = false;
     
     // input
     bool strobe = true;
-    bool reading = false;
     uint8_t button = 0;
-    bool pressed[8];
+    bool pressed[8] = {};
     
     // ppu
     std::shared_ptr<PPU> ppu;
-    std::array<uint8_t, PATTERN_TABLE> left;
-    std::array<uint8_t, PATTERN_TABLE> right;
     std::array<std::array<uint8_t, NAMETABLE>, 4> nametables;
+    std::array<uint8_t*, 4> nametable_banks;
     std::array<std::array<uint8_t, PALETTE>, 4> back_palettes;
     std::array<std::array<uint8_t, PALETTE>, 4> sprite_palettes;
     uint8_t univ_back_color;
@@ -115,19 +141,27 @@ public:
     void set_cpu(std::shared_ptr<CPU> cpu);
     void set_ppu(std::shared_ptr<PPU> ppu);
     void set_apu(std::shared_ptr<APU> apu);
+    
+    // mapper only methods
+    void set_prg_bank(uint8_t slot, const uint8_t* bank);
+    void set_chr_bank(uint8_t slot, const uint8_t* bank);
+    void set_mirroring(uint8_t mode);
 
     // cpu only methods
     Mem(std::shared_ptr<ROM> game);
     uint16_t reset_vector();
     uint16_t nmi_vector();
+    uint16_t irq_vector();
     uint8_t mem_read(uint64_t index);
     uint16_t mem_read2(uint64_t index);
     void mem_write(uint64_t index, uint8_t value);
     bool read_nmi();
+    bool read_irq();
     
     // ppu only methods
     uint8_t ppu_read(uint64_t index);
-    uint8_t ppu_write(uint64_t index, uint8_t value);
+    void ppu_write(uint64_t index, uint8_t value);
+    uint16_t ppu_read_row(uint64_t index, bool flip);
 
     // apu only methods
     void apu_reg_write(uint64_t index, uint8_t value);
@@ -135,6 +169,8 @@ public:
     uint8_t ppu_reg_read(uint64_t index);
     void ppu_reg_write(uint64_t index, uint8_t value);
     void set_nmi(bool nmi);
+    void set_irq(bool irq);
+    void a12_rise();
     uint64_t get_cpu_cycle();
     
     std::array<uint8_t, NAMETABLE> get_nametable(uint8_t index);
@@ -20,7 +20,7 @@ NES::NES(const char* filename) {
 
 
     
-    rom = std::make_shared<ROM>(filename);
+    rom = ROM::open(filename);
     memory = std::make_shared<Mem>(rom);
     
     cpu = std::make_shared<CPU>(memory);
@@ -55,6 +55,86 @@ void NES::run() {
     }
 }
 
+void NES::set_render_mode(uint8_t mode) {
+    ppu->set_render_mode(mode);
+}
+
+void NES::set_viewport(uint16_t left, uint16_t top, uint16_t right, uint16_t bottom) {
+    ppu->set_viewport(left, top, right, bottom);
+}
+
+void NES::set_ntsc(bool enabled) {
+    ppu->set_ntsc(enabled);
+}
+
+void NES::start_capture(const char* filename, uint8_t format) {
+    ppu->start_capture(filename, format);
+}
+
+void NES::stop_capture() {
+    ppu->stop_capture();
+}
+
+void NES::set_present(bool present) {
+    ppu->set_present(present);
+}
+
+void NES::set_observation(const ObserveConfig& config) {
+    ppu->set_observation(config);
+}
+
+size_t NES::get_observation_size() {
+    return ppu->get_observation_size();
+}
+
+void NES::observe(uint8_t* out) {
+    ppu->observe(out);
+}
+
+const RomIdentity& NES::get_rom_identity() const {
+    return rom->get_identity();
+}
+
+uint64_t NES::get_frame_hash() {
+    return ppu->get_frame_hash();
+}
+
+bool NES::is_frame_changed() {
+    return ppu->is_frame_changed();
+}
+
+void NES::run_frames(uint64_t count) {
+    // as fast as possible, unlike run which keeps to real time
+    uint64_t target = ppu->get_frame_count() + count;
+    while (running && ppu->get_frame_count() < target) {
+        execute();
+    }
+}
+
+bool NES::is_running() {
+    return running;
+}
+
+uint64_t NES::get_frame_count() {
+    return ppu->get_frame_count();
+}
+
+void NES::set_button(uint8_t button, bool pressed) {
+    if (pressed) {
+        memory->button_press(button);
+    } else {
+        memory->button_release(button);
+    }
+}
+
+void NES::set_keep_frame(bool keep) {
+    ppu->set_keep_frame(keep);
+}
+
+const uint32_t* NES::get_kept_frame() {
+    return ppu->get_kept_frame();
+}
+
 void NES::cpu_run() {
     while (true) {
         cpu->execute();
@@ -83,12 +163,8 @@ void NES::execute() {
         running = false;
     } else {
         cycles += passed;
-        for (int i = 0; i < passed * 3; i++) {
-            ppu->execute();
-        }
-        for (int i = 0; i < passed * 2; i++) {
-            apu->execute();
-        }
+        ppu->run(passed * 3);
+        apu->run(passed);
     }
     
     run_t--;
@@ -97,6 +173,12 @@ void NES::execute() {
 void NES::poll_input() {
     SDL_PollEvent(event);
     
+    // closing the vram viewer's window only closes the viewer
+    if (event->type == SDL_WINDOWEVENT && event->window.event == SDL_WINDOWEVENT_CLOSE &&
+        event->window.windowID == ppu->get_debug_view_window()) {
+        ppu->set_debug_view(false);
+    }
+    
     if (event->type == SDL_KEYDOWN) {
         uint64_t kdown = event->key.keysym.sym;
         switch (kdown) {
@@ -152,7 +234,6 @@ void NES::poll_input() {
                  if (!kstate[NES_START]) {
                      std::cout << "press start" << std::endl;
                      memory->button_press(NES_START);
-                     ppu->kmsv1();
                      kstate[NES_START] = true;
                  }
                  break;
@@ -161,11 +242,17 @@ void NES::poll_input() {
                  if (!kstate[NES_SELECT]) {
                      std::cout << "press select" << std::endl;
                      memory->button_press(NES_SELECT);
-                     ppu->kmsv2();
                      kstate[NES_SELECT] = true;
                  }
                  break;
              }
+             // opens and closes the vram viewer
+             case SDLK_F1: {
+                 if (!event->key.repeat) {
+                     ppu->set_debug_view(!ppu->is_debug_view_open());
+                 }
+                 break;
+             }
          }
     }
     
@@ -242,6 +329,9 @@ void NES::poll_input() {
 }
 
 NES::~NES() {
+    // mem and the ppu point at each other, so the capture is finished here
+    ppu->stop_capture();
+    
     SDL_DestroyWindow(window);
     window = NULL;
     SDL_Quit();
@@ -54,6 +54,34 @@ public:
     ~NES();
     void run();
     void execute();
+    void set_render_mode(uint8_t mode);
+    void set_viewport(uint16_t left, uint16_t top, uint16_t right, uint16_t bottom);
+    void set_ntsc(bool enabled);
+    
+    // hashes of the loaded rom, after the database lookup
+    const RomIdentity& get_rom_identity() const;
+    
+    // every frame to a file, see capture.hpp for the formats
+    void start_capture(const char* filename, uint8_t format);
+    void stop_capture();
+    
+    // frames for agents instead of (or as well as) the window
+    void set_present(bool present);
+    void set_observation(const ObserveConfig& config);
+    size_t get_observation_size();
+    void observe(uint8_t* out);
+    
+    // hash of the last finished frame and whether it differs from the one before
+    uint64_t get_frame_hash();
+    bool is_frame_changed();
+    
+    // scripted runs, see regress.hpp
+    void run_frames(uint64_t count);
+    bool is_running();
+    uint64_t get_frame_count();
+    void set_button(uint8_t button, bool pressed);
+    void set_keep_frame(bool keep);
+    const uint32_t* get_kept_frame();
     
     void cpu_run();
     void ppu_run();
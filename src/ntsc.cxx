@@ -0,0 +1,228 @@
+#include "ntsc.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// output pixels kept either side of the line for kernels hanging off the ends
+#define NTSC_MARGIN     4
+
+// decoder tuning, so flat areas come out close to the usual palette
+#define NTSC_HUE        4.0f
+#define NTSC_SATURATION 1.2f
+
+static const float ntsc_levels[8] = {
+    0.228f, 0.312f, 0.552f, 0.880f,     // low
+    0.616f, 0.840f, 1.100f, 1.100f      // high
+};
+
+static bool in_color_phase(int hue, int phase) {
+    return (hue + phase) % 12 < 6;
+}
+
+// one sample of a colour at a phase of the 12 sample colour cycle, 0 to 1
+static float ntsc_signal(int color, int phase) {
+    int hue = color & 0x0f;
+    int level = hue > 13 ? 1 : (color >> 4) & 0x3;
+    int emphasis = color >> 6;
+
+    float low = ntsc_levels[level];
+    float high = ntsc_levels[4 + level];
+    if (hue == 0) low = high;
+    if (hue > 12) high = low;
+
+    float value = in_color_phase(hue, phase) ? high : low;
+
+    // red, green and blue emphasis each pull down their third of the cycle
+    if (((emphasis & 1) && in_color_phase(0, phase)) ||
+        ((emphasis & 2) && in_color_phase(4, phase)) ||
+        ((emphasis & 4) && in_color_phase(8, phase))) {
+        value *= NTSC_ATTENUATE;
+    }
+    return (value - NTSC_BLACK) / (NTSC_WHITE - NTSC_BLACK);
+}
+
+NtscFilter::NtscFilter(int threads) {
+    build_kernels();
+
+    if (threads <= 0) {
+        threads = std::min<int>(std::thread::hardware_concurrency(), NTSC_MAX_THREADS);
+    }
+    threads = std::max(std::min(threads, NTSC_HEIGHT), 1);
+
+    // the calling thread takes band 0
+    for (int band = 1; band < threads; band++) {
+        workers.emplace_back(&NtscFilter::work, this, band);
+    }
+}
+
+NtscFilter::~NtscFilter() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    start.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void NtscFilter::build_kernels() {
+    kernels.assign(NTSC_PHASES * 3 * NTSC_COLORS * NTSC_TAPS, {0, 0, 0, 0});
+
+    // 3 pixels are 24 samples and 7 output pixels, each output pixel decodes
+    // the colour cycle (12 samples) around its centre
+    const float spacing = 24.0f / 7;
+
+    for (int place = 0; place < 3; place++) {
+        // outputs whose window reaches this pixel's samples
+        int first = (int) std::floor((place * 8 - 6) / spacing - 0.5f) + 1;
+        first_tap[place] = first;
+
+        for (int phase = 0; phase < NTSC_PHASES; phase++) {
+            for (int color = 0; color < NTSC_COLORS; color++) {
+                std::array<int32_t, 4>* taps = kernels.data() + ((phase * 3 + place) * NTSC_COLORS + color) * NTSC_TAPS;
+
+                for (int tap = 0; tap < NTSC_TAPS; tap++) {
+                    float centre = (first + tap + 0.5f) * spacing;
+                    float y = 0, i = 0, q = 0;
+
+                    for (int n = place * 8; n < place * 8 + 8; n++) {
+                        float weight = std::min(n + 1.0f, centre + 6) - std::max((float) n, centre - 6);
+                        if (weight <= 0) {
+                            continue;
+                        }
+                        int sample_phase = (n + phase * 4) % 12;
+                        float value = ntsc_signal(color, sample_phase) * weight / 12;
+                        float angle = (sample_phase + NTSC_HUE) * (float) M_PI / 6;
+                        y += value;
+                        i += value * std::cos(angle) * NTSC_SATURATION;
+                        q += value * std::sin(angle) * NTSC_SATURATION;
+                    }
+
+                    float r = y + 0.946882f * i + 0.623557f * q;
+                    float g = y - 0.274788f * i - 0.635691f * q;
+                    float b = y - 1.108545f * i + 1.709007f * q;
+
+                    float scale = 255.0f * (1 << NTSC_SHIFT);
+                    taps[tap] = {(int32_t) std::lround(b * scale), (int32_t) std::lround(g * scale), (int32_t) std::lround(r * scale), 0};
+                }
+            }
+        }
+    }
+}
+
+void NtscFilter::filter(const uint8_t* frame, const uint8_t* emphasis, uint32_t* out, int pitch) {
+    this->frame = frame;
+    this->emphasis = emphasis;
+    this->out = out;
+    this->pitch = pitch;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        generation++;
+        remaining = workers.size();
+    }
+    start.notify_all();
+
+    filter_band(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return remaining == 0; });
+
+    frame_phase = frame_phase == NTSC_PHASES - 1 ? 0 : frame_phase + 1;
+}
+
+void NtscFilter::work(int band) {
+    uint64_t seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            start.wait(guard, [this, seen] { return !running || generation != seen; });
+            if (!running) {
+                return;
+            }
+            seen = generation;
+        }
+
+        filter_band(band);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            remaining--;
+        }
+        done.notify_one();
+    }
+}
+
+void NtscFilter::filter_band(int band) {
+    int bands = workers.size() + 1;
+    int top = band * NTSC_HEIGHT / bands;
+    int bottom = (band + 1) * NTSC_HEIGHT / bands;
+
+    for (int y = top; y < bottom; y++) {
+        filter_line(y);
+    }
+}
+
+void NtscFilter::filter_line(int y) {
+    alignas(16) std::array<std::array<int32_t, 4>, NTSC_WIDTH + NTSC_MARGIN * 2> sums;
+    std::memset(sums.data(), 0, sizeof(sums));
+
+    int phase = (frame_phase + y) % NTSC_PHASES;
+    const uint8_t* line = frame + y * NTSC_IN_WIDTH;
+    uint16_t emphasis_bits = (emphasis[y] & 0x7) << 6;
+
+    for (int x = 0, group = 0; x < NTSC_IN_WIDTH; group++) {
+        for (int place = 0; place < 3 && x < NTSC_IN_WIDTH; place++, x++) {
+            uint16_t color = emphasis_bits | (line[x] & 0x3f);
+            const std::array<int32_t, 4>* taps = kernels.data() + ((phase * 3 + place) * NTSC_COLORS + color) * NTSC_TAPS;
+            std::array<int32_t, 4>* sum = sums.data() + NTSC_MARGIN + group * 7 + first_tap[place];
+
+#ifdef __SSE2__
+            for (int tap = 0; tap < NTSC_TAPS; tap++) {
+                __m128i value = _mm_load_si128((const __m128i*) sum[tap].data());
+                value = _mm_add_epi32(value, _mm_loadu_si128((const __m128i*) taps[tap].data()));
+                _mm_store_si128((__m128i*) sum[tap].data(), value);
+            }
+#else
+            for (int tap = 0; tap < NTSC_TAPS; tap++) {
+                for (int channel = 0; channel < 4; channel++) {
+                    sum[tap][channel] += taps[tap][channel];
+                }
+            }
+#endif
+        }
+    }
+
+    uint32_t* row = (uint32_t*) ((uint8_t*) out + y * pitch);
+    const std::array<int32_t, 4>* sum = sums.data() + NTSC_MARGIN;
+    int x = 0;
+
+#ifdef __SSE2__
+    // four pixels at a time, saturating down to bytes
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    for (; x + 4 <= NTSC_WIDTH; x += 4) {
+        __m128i a = _mm_srai_epi32(_mm_load_si128((const __m128i*) sum[x].data()), NTSC_SHIFT);
+        __m128i b = _mm_srai_epi32(_mm_load_si128((const __m128i*) sum[x + 1].data()), NTSC_SHIFT);
+        __m128i c = _mm_srai_epi32(_mm_load_si128((const __m128i*) sum[x + 2].data()), NTSC_SHIFT);
+        __m128i d = _mm_srai_epi32(_mm_load_si128((const __m128i*) sum[x + 3].data()), NTSC_SHIFT);
+        __m128i pixels = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i*) (row + x), _mm_or_si128(pixels, alpha));
+    }
+#endif
+
+    for (; x < NTSC_WIDTH; x++) {
+        uint32_t pixel = 0xff000000;
+        for (int channel = 0; channel < 3; channel++) {
+            int32_t value = std::min(std::max(sum[x][channel] >> NTSC_SHIFT, 0), 255);
+            pixel |= value << (channel * 8);
+        }
+        row[x] = pixel;
+    }
+}
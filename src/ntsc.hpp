@@ -0,0 +1,76 @@
+#ifndef ntsc_hpp
+#define ntsc_hpp
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// NTSC composite filter. Every pixel is 8 samples of the NES video signal,
+// which a YIQ decoder turns into 7 output pixels for every 3 in. Decoding is
+// linear in the signal, so each colour's effect on the pixels around it is
+// worked out once, for each of the 3 places in a group of 3 pixels and each
+// of the 3 colour burst phases a line can start on. Filtering a line is then
+// adding those kernels up.
+//
+// Lines are split into bands across worker threads. The sums are SSE2 when
+// the compiler targets it.
+
+#define NTSC_IN_WIDTH   256
+#define NTSC_HEIGHT     240
+#define NTSC_WIDTH      602
+#define NTSC_TAPS       6
+#define NTSC_PHASES     3
+#define NTSC_COLORS     512
+#define NTSC_MAX_THREADS 4
+
+// kernels hold RGB * (1 << NTSC_SHIFT)
+#define NTSC_SHIFT      8
+
+// the signal, from the levels measured on real hardware
+#define NTSC_BLACK      0.312f
+#define NTSC_WHITE      1.100f
+#define NTSC_ATTENUATE  0.746f
+
+class NtscFilter {
+private:
+    // [phase][pixel in group][emphasis << 6 | colour][tap] as B, G, R, 0
+    std::vector<std::array<int32_t, 4>> kernels;
+    // first output pixel each place in a group reaches, from the group's first
+    std::array<int, 3> first_tap;
+
+    // the line phase moves on by one every frame
+    uint8_t frame_phase = 0;
+
+    // the frame being filtered, shared with the workers
+    const uint8_t* frame;
+    const uint8_t* emphasis;
+    uint32_t* out;
+    int pitch;
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable start;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    int remaining = 0;
+    bool running = true;
+
+    void build_kernels();
+    void work(int band);
+    void filter_band(int band);
+    void filter_line(int y);
+
+public:
+    // threads is how many bands a frame is cut into, 0 picks from the cpu
+    NtscFilter(int threads = 0);
+    ~NtscFilter();
+
+    // frame is 256x240 palette colours and emphasis the PPUMASK emphasis
+    // bits of each line, out is NTSC_WIDTH x 240 ARGB with pitch in bytes
+    void filter(const uint8_t* frame, const uint8_t* emphasis, uint32_t* out, int pitch);
+};
+
+#endif
@@ -0,0 +1,240 @@
+#include "observe.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#endif
+
+// kernels
+
+// 64 entry table lookup on 6 bit values
+static void observe_lookup(const uint8_t* in, uint8_t* out, int count, const uint8_t* lut) {
+    int x = 0;
+    
+#ifdef __SSSE3__
+    // pshufb indexes 16 entries, so each quarter of the table takes one
+    // shuffle and the top two bits pick which result is kept
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i quarter_mask = _mm_set1_epi8(0x03);
+    std::array<__m128i, 4> tables;
+    for (int i = 0; i < 4; i++) {
+        tables[i] = _mm_loadu_si128((const __m128i*) (lut + i * 16));
+    }
+    
+    for (; x + 16 <= count; x += 16) {
+        __m128i value = _mm_loadu_si128((const __m128i*) (in + x));
+        __m128i low = _mm_and_si128(value, low_mask);
+        __m128i quarter = _mm_and_si128(_mm_srli_epi16(value, 4), quarter_mask);
+        
+        __m128i result = _mm_setzero_si128();
+        for (int i = 0; i < 4; i++) {
+            __m128i pick = _mm_cmpeq_epi8(quarter, _mm_set1_epi8(i));
+            result = _mm_or_si128(result, _mm_and_si128(pick, _mm_shuffle_epi8(tables[i], low)));
+        }
+        _mm_storeu_si128((__m128i*) (out + x), result);
+    }
+#endif
+    
+    for (; x < count; x++) {
+        out[x] = lut[in[x] & 0x3f];
+    }
+}
+
+// weighted sum of whole rows, weights out of 256
+static void observe_blend(const uint8_t* const* rows, const uint16_t* weights, int taps, uint8_t* out, int count) {
+    int x = 0;
+    
+#ifdef __SSE2__
+    // 255 * 256 + 128 still fits 16 bits unsigned
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    
+    for (; x + 16 <= count; x += 16) {
+        __m128i sum_low = round;
+        __m128i sum_high = round;
+        
+        for (int t = 0; t < taps; t++) {
+            __m128i value = _mm_loadu_si128((const __m128i*) (rows[t] + x));
+            __m128i weight = _mm_set1_epi16(weights[t]);
+            sum_low = _mm_add_epi16(sum_low, _mm_mullo_epi16(_mm_unpacklo_epi8(value, zero), weight));
+            sum_high = _mm_add_epi16(sum_high, _mm_mullo_epi16(_mm_unpackhi_epi8(value, zero), weight));
+        }
+        
+        __m128i result = _mm_packus_epi16(_mm_srli_epi16(sum_low, 8), _mm_srli_epi16(sum_high, 8));
+        _mm_storeu_si128((__m128i*) (out + x), result);
+    }
+#endif
+    
+    for (; x < count; x++) {
+        uint32_t sum = 128;
+        for (int t = 0; t < taps; t++) {
+            sum += rows[t][x] * weights[t];
+        }
+        out[x] = sum >> 8;
+    }
+}
+
+static void observe_max(const uint8_t* a, const uint8_t* b, uint8_t* out, int count) {
+    int x = 0;
+    
+#ifdef __SSE2__
+    for (; x + 16 <= count; x += 16) {
+        __m128i left = _mm_loadu_si128((const __m128i*) (a + x));
+        __m128i right = _mm_loadu_si128((const __m128i*) (b + x));
+        _mm_storeu_si128((__m128i*) (out + x), _mm_max_epu8(left, right));
+    }
+#endif
+    
+    for (; x < count; x++) {
+        out[x] = std::max(a[x], b[x]);
+    }
+}
+
+// Observer
+
+Observer::Observer(const ObserveConfig& config, const uint32_t* colors) {
+    if (config.format != OBSERVE_INDICES && config.format != OBSERVE_GREY) {
+        throw std::invalid_argument("unknown observation format");
+    }
+    if (!config.crop_width || !config.crop_height || config.x + config.crop_width > 256 || config.y + config.crop_height > 240) {
+        throw std::invalid_argument("observation crop is off screen");
+    }
+    if (!config.width || !config.height || !config.stack || config.stack > OBSERVE_MAX_STACK) {
+        throw std::invalid_argument("invalid observation size");
+    }
+    
+    this->config = config;
+    
+    for (int i = 0; i < 64; i++) {
+        if (config.format == OBSERVE_GREY) {
+            // palette entries are RGBA, weighted as BT.601 luma
+            uint32_t r = (colors[i] >> 24) & 0xff;
+            uint32_t g = (colors[i] >> 16) & 0xff;
+            uint32_t b = (colors[i] >> 8) & 0xff;
+            lut[i] = (r * 299 + g * 587 + b * 114 + 500) / 1000;
+        } else {
+            lut[i] = i;
+        }
+    }
+    
+    column_taps = make_taps(config.crop_width, config.width);
+    row_taps = make_taps(config.crop_height, config.height);
+    
+    // room for the most rows any output row blends
+    size_t most = 0;
+    for (const ObserveTaps& tap : row_taps) {
+        most = std::max(most, tap.weights.size());
+    }
+    rows.resize(most);
+    
+    lines.resize(config.crop_width * config.crop_height);
+    columns.resize(config.width * config.crop_height);
+    frames.assign(get_size(), 0);
+    previous.assign(get_frame_size(), 0);
+    spare.resize(get_frame_size());
+}
+
+std::vector<ObserveTaps> Observer::make_taps(uint16_t source, uint16_t output) {
+    std::vector<ObserveTaps> taps(output);
+    double scale = (double) source / output;
+    
+    for (int o = 0; o < output; o++) {
+        ObserveTaps& tap = taps[o];
+        
+        if (config.format == OBSERVE_INDICES) {
+            // averaging indices means nothing, take the nearest one
+            tap.first = std::min<int>(source - 1, (int) ((o + 0.5) * scale));
+            tap.weights.assign(1, 256);
+            continue;
+        }
+        
+        // each source pixel counts for how much of it the output pixel covers
+        double start = o * scale;
+        double end = (o + 1) * scale;
+        int first = std::floor(start);
+        int last = std::min<int>(std::ceil(end), source) - 1;
+        last = std::max(first, last);
+        
+        tap.first = first;
+        int total = 0;
+        for (int p = first; p <= last; p++) {
+            double cover = std::min<double>(end, p + 1) - std::max<double>(start, p);
+            uint16_t weight = std::lround(std::max(cover, 0.0) / scale * 256);
+            tap.weights.push_back(weight);
+            total += weight;
+        }
+        
+        // rounding can leave the sum a little off 256
+        auto largest = std::max_element(tap.weights.begin(), tap.weights.end());
+        *largest += 256 - total;
+    }
+    
+    return taps;
+}
+
+size_t Observer::get_frame_size() {
+    return config.width * config.height;
+}
+
+size_t Observer::get_size() {
+    return get_frame_size() * config.stack;
+}
+
+void Observer::push(const uint8_t* frame) {
+    uint16_t crop_width = config.crop_width;
+    uint16_t width = config.width;
+    
+    // crop, and indices or grey through the table
+    for (int y = 0; y < config.crop_height; y++) {
+        const uint8_t* in = frame + (config.y + y) * 256 + config.x;
+        observe_lookup(in, lines.data() + y * crop_width, crop_width, lut.data());
+    }
+    
+    // across, one output column at a time
+    for (int y = 0; y < config.crop_height; y++) {
+        const uint8_t* in = lines.data() + y * crop_width;
+        uint8_t* out = columns.data() + y * width;
+        
+        for (int x = 0; x < width; x++) {
+            const ObserveTaps& tap = column_taps[x];
+            uint32_t sum = 128;
+            for (size_t t = 0; t < tap.weights.size(); t++) {
+                sum += in[tap.first + t] * tap.weights[t];
+            }
+            out[x] = sum >> 8;
+        }
+    }
+    
+    // down, whole output rows at a time into the next stack slot
+    stack_head = (stack_head + 1) % config.stack;
+    uint8_t* slot = frames.data() + stack_head * get_frame_size();
+    
+    for (int y = 0; y < config.height; y++) {
+        const ObserveTaps& tap = row_taps[y];
+        for (size_t t = 0; t < tap.weights.size(); t++) {
+            rows[t] = columns.data() + (tap.first + t) * width;
+        }
+        observe_blend(rows.data(), tap.weights.data(), tap.weights.size(), slot + y * width, width);
+    }
+    
+    if (config.max_pool) {
+        std::memcpy(spare.data(), slot, get_frame_size());
+        observe_max(slot, previous.data(), slot, get_frame_size());
+        std::swap(previous, spare);
+    }
+}
+
+void Observer::read(uint8_t* out) {
+    size_t size = get_frame_size();
+    
+    for (int i = 0; i < config.stack; i++) {
+        int index = (stack_head + 1 + i) % config.stack;
+        std::memcpy(out + i * size, frames.data() + index * size, size);
+    }
+}
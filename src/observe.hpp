@@ -0,0 +1,83 @@
+#ifndef observe_hpp
+#define observe_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <stdexcept>
+
+// Frame output for agents. Each finished frame is cropped, turned into 6 bit
+// palette indices or greyscale, area-downsampled, optionally max-pooled with
+// the frame before and pushed onto a stack of the last few frames. Nothing
+// here ever builds a full size RGB frame.
+
+#define OBSERVE_INDICES     0
+#define OBSERVE_GREY        1
+
+#define OBSERVE_MAX_STACK   16
+
+struct ObserveConfig {
+    uint8_t format = OBSERVE_GREY;
+    
+    // crop rectangle on the 256x240 screen
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint16_t crop_width = 256;
+    uint16_t crop_height = 240;
+    
+    // output size, indices are sampled nearest instead of averaged
+    uint16_t width = 84;
+    uint16_t height = 84;
+    
+    // max of each frame with the one before, so flickering sprites show
+    bool max_pool = false;
+    
+    // frames per observation, oldest first
+    uint8_t stack = 4;
+};
+
+// source pixels that make up one output pixel along an axis, weights sum to 256
+struct ObserveTaps {
+    uint16_t first;
+    std::vector<uint16_t> weights;
+};
+
+class Observer {
+private:
+    ObserveConfig config;
+    std::array<uint8_t, 64> lut;
+    
+    std::vector<ObserveTaps> column_taps;
+    std::vector<ObserveTaps> row_taps;
+    
+    // cropped and converted, then downsampled across
+    std::vector<uint8_t> lines;
+    std::vector<uint8_t> columns;
+    std::vector<const uint8_t*> rows;
+    
+    // the stack is a ring of frames, newest at stack_head
+    std::vector<uint8_t> frames;
+    uint8_t stack_head = 0;
+    
+    // last frame before pooling, and a spare to swap with it
+    std::vector<uint8_t> previous;
+    std::vector<uint8_t> spare;
+    
+    std::vector<ObserveTaps> make_taps(uint16_t source, uint16_t output);
+    
+public:
+    // colors is the 64 entry RGBA palette, used for the greyscale table
+    Observer(const ObserveConfig& config, const uint32_t* colors);
+    
+    size_t get_frame_size();
+    size_t get_size();
+    
+    // frame is 256x240 palette colours, row after row
+    void push(const uint8_t* frame);
+    
+    // the whole stack into the caller's buffer of get_size() bytes
+    void read(uint8_t* out);
+};
+
+#endif
@@ -1,4 +1,12 @@
 #include "ppu.hpp"
+#include "compose.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 void Sprite::ff() {
     Y = 0xff;
@@ -45,10 +53,19 @@ PPU::PPU(std::shared_ptr<Mem> memory, SDL_Window* window) {
     this->window = window;
     
     renderer = SDL_CreateRenderer(window, -1, 0);
-    screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, WIDTH, HEIGHT);
+    // frames are expanded straight into the locked texture, see display
+    screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+    
+    line_emphasis.fill(0);
+    line_hashes.fill(0);
+    sprite_line.fill(0);
+    build_palette_lut();
 }
 
 PPU::~PPU() {
+    if (ntsc_screen) {
+        SDL_DestroyTexture(ntsc_screen);
+    }
     SDL_DestroyTexture(screen);
     SDL_DestroyRenderer(renderer);
 }
@@ -98,13 +115,8 @@ bool PPU::get_vblank_nmi_flag() {
 void PPU::vram_increment() {
     uint8_t inc = get_vram_increment();
     
-    std::cout << unsigned(inc) << std::endl;
-    
-    vram_addr += inc;
-    
-    if (vram_addr > 0x3fff) {
-        vram_addr -= 0x3fff;
-    }
+    // fine y scrolling leaves bits above $3FFF set, the address wraps like the ppu's 14 bit bus
+    vram_addr = (vram_addr + inc) & 0x3fff;
 }
 
 // PPUMASK
@@ -175,15 +187,162 @@ uint16_t PPU::get_attribute_address() {
     return addr;
 }
 
+uint16_t PPU::fetch_row(uint16_t addr, bool flip) {
+    // only edges are reported, so the mapper hears about this once per scanline
+    bool a12 = addr & 0x1000;
+    
+    if (a12 && !a12_high) {
+        if (cycles - a12_low_cycle >= A12_FILTER) {
+            memory->a12_rise();
+        }
+        a12_high = true;
+    } else if (!a12 && a12_high) {
+        a12_low_cycle = cycles;
+        a12_high = false;
+    }
+    
+    // both planes come pre-decoded in one row
+    return memory->ppu_read_row(addr, flip);
+}
+
 // timing
 
+typedef std::array<std::array<uint32_t, DOTS>, LINE_KINDS> DotActions;
+
+static DotActions make_dot_actions() {
+    DotActions actions = {};
+    
+    // background fetches, 8 dots a tile for the line and the next line's first two
+    for (int kind : {LINE_VISIBLE, LINE_PRE_RENDER}) {
+        std::array<uint32_t, DOTS>& line = actions[kind];
+        
+        for (int dot = 1; dot < 337; dot++) {
+            if (dot > 256 && dot < 321) {
+                continue;
+            }
+            switch (dot & 0x7) {
+                case 1: {
+                    line[dot] |= DOT_NAMETABLE;
+                    break;
+                }
+                case 3: {
+                    line[dot] |= DOT_ATTRIBUTE;
+                    break;
+                }
+                case 5: {
+                    line[dot] |= DOT_PATTERN;
+                    break;
+                }
+                case 0: {
+                    line[dot] |= DOT_RELOAD | (dot == 256 ? DOT_INC_Y : DOT_INC_X);
+                    break;
+                }
+            }
+        }
+        line[257] |= DOT_COPY_X;
+        
+        // one fetch per sprite slot, the line buffer once they're all in
+        for (int dot = 257; dot < 321; dot += 8) {
+            line[dot] |= DOT_SPRITE_FETCH;
+        }
+        line[320] |= DOT_SPRITE_LINE;
+    }
+    
+    std::array<uint32_t, DOTS>& visible = actions[LINE_VISIBLE];
+    for (int dot = 1; dot < 257; dot++) {
+        visible[dot] |= DOT_PIXEL;
+    }
+    visible[1] |= DOT_LINE_START;
+    visible[256] |= DOT_EVALUATE;
+    visible[257] |= DOT_HASH;
+    
+    // the pre-render line only does the sprite fetches
+    std::array<uint32_t, DOTS>& pre_render = actions[LINE_PRE_RENDER];
+    pre_render[1] |= DOT_CLEAR_FLAGS;
+    for (int dot = 280; dot < 305; dot++) {
+        pre_render[dot] |= DOT_COPY_Y;
+    }
+    pre_render[340] |= DOT_END_FRAME;
+    
+    actions[LINE_VBLANK][1] |= DOT_SET_VBLANK;
+    
+    return actions;
+}
+
+static std::array<uint8_t, SCANLINES> make_line_kinds() {
+    std::array<uint8_t, SCANLINES> kinds;
+    kinds.fill(LINE_IDLE);
+    std::fill(kinds.begin(), kinds.begin() + HEIGHT, LINE_VISIBLE);
+    kinds[241] = LINE_VBLANK;
+    kinds[261] = LINE_PRE_RENDER;
+    return kinds;
+}
+
+static const DotActions dot_actions = make_dot_actions();
+static const std::array<uint8_t, SCANLINES> line_kinds = make_line_kinds();
+
+// for rendering off and on, the first dot from each dot on that has to
+// be executed, DOTS when nothing is left on the line
+typedef std::array<std::array<std::array<uint16_t, DOTS>, LINE_KINDS>, 2> NextDots;
+
+static NextDots make_next_dots() {
+    NextDots next;
+    
+    for (int render = 0; render < 2; render++) {
+        uint32_t stops = render ? ~0u : DOT_STOPS_OFF;
+        
+        for (int kind = 0; kind < LINE_KINDS; kind++) {
+            uint16_t found = DOTS;
+            for (int dot = DOTS - 1; dot >= 0; dot--) {
+                if (dot_actions[kind][dot] & stops) found = dot;
+                next[render][kind][dot] = found;
+            }
+        }
+    }
+    return next;
+}
+
+// the next line after each one with any actions, every kind but idle has some
+static std::array<uint16_t, SCANLINES> make_next_lines() {
+    std::array<uint16_t, SCANLINES> next;
+    
+    // line 0 is visible, so the end of the frame wraps around to it
+    uint16_t found = 0;
+    for (int line = SCANLINES - 1; line >= 0; line--) {
+        next[line] = found;
+        if (line_kinds[line] != LINE_IDLE) found = line;
+    }
+    return next;
+}
+
+static const NextDots next_dots = make_next_dots();
+static const std::array<uint16_t, SCANLINES> next_lines = make_next_lines();
+
 void PPU::inc_cycle() {
     cycles++;
-    if (cycles % 341 == 0) inc_scanline();
+    if (++dot == DOTS) {
+        dot = 0;
+        inc_scanline();
+    }
 }
 
 void PPU::inc_scanline() {
-    current_scanline = (current_scanline + 1) % 262;
+    if (++current_scanline == SCANLINES) {
+        current_scanline = 0;
+    }
+}
+
+void PPU::skip_dots(uint64_t count) {
+    // nothing happens on these dots, so only the counters move
+    cycles += count;
+    
+    uint64_t position = dot + count;
+    dot = position % DOTS;
+    current_scanline = (current_scanline + position / DOTS) % SCANLINES;
+    
+    if (memory->get_cpu_cycle() < 29659) {
+        clear_writes();
+    }
 }
 
 void PPU::ext_reg_write(uint64_t index, uint8_t value) {
@@ -191,6 +350,8 @@ void PPU::ext_reg_write(uint64_t index, uint8_t value) {
         throw std::out_of_range("invalid ppu register index");
     }
     
+    catch_up();
+    
     // scrolling register controls
     switch (index) {
         // PPUCTRL
@@ -251,7 +412,7 @@ void PPU::ext_reg_write(uint64_t index, uint8_t value) {
         }
         case 7: {
             if (get_vblank_nmi_flag() || !is_rendering_enabled()) {
-                memory->ppu_write(vram_addr, value);
+                memory->ppu_write(vram_addr & 0x3fff, value);
                 vram_increment();
             }
             break;
@@ -264,6 +425,8 @@ void PPU::ext_reg_write(uint64_t index, uint8_t value) {
 }
 
 uint8_t PPU::ext_reg_read(uint64_t index) {
+    catch_up();
+    
     uint8_t value = regs[index];
     switch (index) {
         case 2: {
@@ -272,11 +435,11 @@ uint8_t PPU::ext_reg_read(uint64_t index) {
         }
         case 7: {
             if (get_vblank_nmi_flag() || !is_rendering_enabled()) {
-                if (vram_addr > 0x3eff) {
-                    value = memory->ppu_read(vram_addr);
+                if ((vram_addr & 0x3fff) > 0x3eff) {
+                    value = memory->ppu_read(vram_addr & 0x3fff);
                     vram_increment();
                 } else {
-                    regs[index] = memory->ppu_read(vram_addr);
+                    regs[index] = memory->ppu_read(vram_addr & 0x3fff);
                     vram_increment();
                 }
                 
@@ -293,6 +456,8 @@ uint8_t PPU::ext_reg_read(uint64_t index) {
 
 void PPU::set_oam(uint8_t byte) {
     //Sets all of OAM to the data on the corresponding input page.
+    catch_up();
+    
     uint16_t word_addr = ((uint16_t) byte) << 8;
     for (int i = 0; i < 0xFF; i+= 4) {
         //Each sprite has 4 bytes of data. We fill the 64 sprites in.
@@ -302,6 +467,8 @@ void PPU::set_oam(uint8_t byte) {
         oam[sprite_index].attributes = memory->mem_read(word_addr + i + 2);
         oam[sprite_index].X = memory->mem_read(word_addr + i + 3);
     }
+    
+    oam_dirty = true;
 }
 
 uint16_t PPU::get_vram_addr() {
@@ -352,264 +519,502 @@ uint8_t PPU::get_nametable_index() {
 }
 
 uint8_t PPU::get_fine_y() {
-    uint8_t fine_y = (vram_addr >> 12) & 0x3;
+    uint8_t fine_y = (vram_addr >> 12) & 0x7;
+    return fine_y;
 }
 
 // DRAWING
 
 
-void PPU::decrement_sprite_counter() {
-//Decrements sprite x-counter, which if 0 means the sprite is active, and begins to be displayed on the screen.
-    for (int i = 0; i < SPRITES_SEC; i++) {
-        if (sprite_x[i] != 0) {
-            sprite_x[i]--;
+void PPU::build_sprite_line() {
+    // sprites go down lowest priority first so the lower oam index wins
+    sprite_line.fill(0);
+    
+    for (int i = SPRITES_SEC - 1; i >= 0; i--) {
+        uint16_t row = sprite_rows[i];
+        uint8_t palette = 0x10 | ((sprite_attributes[i] & 0x3) << 2);
+        if (sprite_attributes[i] & 0x20) palette |= COMPOSE_BEHIND;
+        if (i == 0 && sprite_0_sec) palette |= SPRITE_0_PIXEL;
+        
+        for (int x = sprite_x[i]; x < sprite_x[i] + 8 && x < WIDTH; x++) {
+            uint8_t color = row & 0x3;
+            row >>= 2;
+            if (color) sprite_line[x] = palette | color;
         }
     }
 }
 
-void PPU::scanl_bkg() {
-    bool bkg_render = get_background_flag();
-    bool spr_render = get_sprite_flag();
+uint16_t PPU::peek_background_row(uint8_t tile) {
+    // the first two tiles of the line sit in the shifters, the rest are
+    // where the fetches will find them, without touching A12
+    if (tile < 2) {
+        return pattern_shift >> (tile * 16);
+    }
     
-    bool render = is_rendering_enabled();
+    uint16_t saved = vram_addr;
+    for (int i = 2; i < tile; i++) {
+        inc_coarse_x();
+    }
+    uint8_t tile_index = memory->ppu_read(get_tile_address());
+    uint16_t addr = get_background_pattern_table_addr() + (((uint16_t) tile_index) << 4) + get_fine_y();
+    vram_addr = saved;
     
-    if (!render) {
+    return memory->ppu_read_row(addr, false);
+}
+
+void PPU::predict_sprite_0_hit() {
+    sprite_0_dot = 0;
+    
+    if (!sprite_0_sec || !get_background_flag() || !get_sprite_flag()) {
         return;
     }
     
-    uint16_t cycle = cycles % 341;
+    // the hit can't happen at x = 255, or where either layer is clipped
+    uint8_t first = (get_background_left_flag() && get_sprite_left_flag()) ? 0 : 8;
     
-    if (cycle == 0) {
-        // do stuff if bg + odd
-        return;
-    } else if ((cycle > 0 && cycle < 257) || (cycle > 320 && cycle < 337)) {
-        uint8_t cycle_prog = cycle % 8;
+    for (int x = first; x < WIDTH - 1; x++) {
+        if (!(sprite_line[x] & SPRITE_0_PIXEL)) {
+            continue;
+        }
         
-        switch (cycle_prog) {
-            // NT byte
-            case 1: {
-                uint16_t tile_addr = get_tile_address();
-                nametable_byte = memory->ppu_read(tile_addr);
-                break;
-            }
-            
-            // AT byte
-            case 3: {
-                uint16_t attr_addr = get_attribute_address();
-                attribute_byte = memory->ppu_read(attr_addr);
-                break;
-            }
-            
-            // low BG tile byte
-            case 5: {
-                uint16_t base_bkg_addr = get_background_pattern_table_addr();
-                uint8_t fine_y = get_fine_y();
-                bkg_addr = (((uint16_t) nametable_byte) << 4) + fine_y;
-                low_pattern = memory->ppu_read(bkg_addr);
-                
-                break;
-            }
-            
-            // high BG tile byte
-            case 7: {
-                bkg_addr += 8;
-                high_pattern = memory->ppu_read(bkg_addr);
-                
-                break;
-            }
-            
-            // add data to registers
-            case 0: {
-                if (cycles == 328) {
-                    palette_attribute_1 = attribute_byte;
-                    high_shift >>= 8;
-                    low_shift >>= 8;
-                } else {
-                    palette_attribute_2 = attribute_byte;
-                    high_shift |= ((uint16_t) high_pattern) << 8;
-                    low_shift |= ((uint16_t) low_pattern) << 8;
-                }
-                
-                if (cycles != 256) inc_coarse_x();
-                else inc_fine_y();
-                break;
-            }
+        uint16_t pos = x + fine_x;
+        uint16_t row = peek_background_row(pos >> 3);
+        if ((row >> ((pos & 7) * 2)) & 0x3) {
+            sprite_0_dot = x + 1;
+            return;
         }
-    } else if (cycle == 257) {
-        vram_addr &= 0xfbe0;
-        vram_addr |= temp_vram_addr & ~0xfbe0;
     }
 }
 
-void PPU::scanl_spr() {
-    
-    // if both renders are disabled, then skip
-    bool render = is_rendering_enabled();
+void PPU::scanl_bkg(uint16_t cycle, uint32_t actions) {
+    // NT byte
+    if (actions & DOT_NAMETABLE) {
+        uint16_t tile_addr = get_tile_address();
+        nametable_byte = memory->ppu_read(tile_addr);
+    }
     
-    if (!render) {
-        return;
+    // AT byte
+    if (actions & DOT_ATTRIBUTE) {
+        uint16_t attr_addr = get_attribute_address();
+        attribute_byte = memory->ppu_read(attr_addr);
     }
     
-    uint16_t cycle = cycles % 341;
+    // BG tile bytes, the decoded row holds both planes
+    if (actions & DOT_PATTERN) {
+        uint16_t base_bkg_addr = get_background_pattern_table_addr();
+        uint8_t fine_y = get_fine_y();
+        bkg_addr = base_bkg_addr + (((uint16_t) nametable_byte) << 4) + fine_y;
+        pattern_row = fetch_row(bkg_addr, false);
+    }
     
-    if (cycle > 0 && cycle < 65) {
-        // clear oam_sec data
-        if (cycle % 8 == 0) {
-            oam_sec[(cycle / 8) - 1].ff();
-        }
+    // add data to registers
+    if (actions & DOT_RELOAD) {
+        // quadrant of the attribute byte this tile uses
+        uint8_t shift = ((vram_addr >> 4) & 0x4) | (vram_addr & 0x2);
+        uint32_t palette = ((attribute_byte >> shift) & 0x3) * 0x5555;
         
-        sprites_found = 0;
-    } else if (cycle > 64 && cycle < 257) {
-        if (cycle == 65) n = 0;
-        
-        if (n < 64) {
-
-            if (cycle % 2) {
-                sprite_buffer = oam[n];
-            } else {
-                if (sprites_found < 8) {
-                    uint8_t distance = get_fine_y() - sprite_buffer.Y;
-                    if (distance < 8) {
-                        oam_sec[sprites_found] = sprite_buffer;
-                        sprites_found++;
-                    }
-                    n++;
-                } else {
-                    while (m < 4 && n < 64) {
-                        uint8_t distance = get_fine_y() - sprite_buffer.byte(m);
-                        if (distance < 8) {
-                            set_overflow_flag(1);
-                            break;
-                        } else {
-                            n++;
-                            m++;
-                        }
-                    }
-                }
-            }
-        } 
-    } else if (cycle > 256 && cycle < 321) {
-        uint8_t cycle_prog = cycle % 8;
-        uint8_t sprite_num = (cycle - 256 - 1) / 8;
+        // the prefetch for the next line starts from empty registers,
+        // and the first tile moves down before the second lands
+        if (cycle == 328) {
+            pattern_shift = 0;
+            palette_shift = 0;
+        } else if (cycle == 336) {
+            pattern_shift >>= 16;
+            palette_shift >>= 16;
+        }
+        pattern_shift |= ((uint32_t) pattern_row) << 16;
+        palette_shift |= palette << 16;
+    }
+    
+    if (actions & DOT_INC_X) {
+        inc_coarse_x();
+    }
+    if (actions & DOT_INC_Y) {
+        inc_fine_y();
+    }
+    
+    // horizontal bits
+    if (actions & DOT_COPY_X) {
+        vram_addr &= 0xfbe0;
+        vram_addr |= temp_vram_addr & ~0xfbe0;
+    }
+    
+    // vertical bits
+    if (actions & DOT_COPY_Y) {
+        vram_addr &= ~0x7be0;
+        vram_addr |= temp_vram_addr & 0x7be0;
+    }
+}
+
+void PPU::scanl_spr(uint16_t cycle, uint32_t actions) {
+    if (actions & DOT_EVALUATE) {
+        evaluate_sprites();
+    }
+    
+    if (actions & DOT_SPRITE_FETCH) {
+        uint8_t sprite_num = (cycle - 257) >> 3;
         
-        sprite_bitmap_low[sprite_num] = get_sprite_bitmap_low(oam_sec[sprite_num]);
-        sprite_bitmap_high[sprite_num] = get_sprite_bitmap_high(oam_sec[sprite_num]);
+        // empty slots still fetch tile $FF, but load transparent rows
+        sprite_rows[sprite_num] = get_sprite_row(oam_sec[sprite_num]);
+        if (sprite_num >= sprites_found) sprite_rows[sprite_num] = 0;
         sprite_attributes[sprite_num] = oam_sec[sprite_num].attributes;
         sprite_x[sprite_num] = oam_sec[sprite_num].X;
     }
+    
+    if (actions & DOT_SPRITE_LINE) {
+        build_sprite_line();
+    }
 }
 
-uint8_t PPU::get_sprite_bitmap_low(Sprite sprite) {
-    uint16_t pattern_addr = get_sprite_pattern_table_addr();
-    pattern_addr += sprite.index << 3;
-    pattern_addr += (current_scanline + 1) % 8;
+void PPU::evaluate_sprites() {
+    // oam rarely changes more than once a frame, so the lines are worked
+    // out when it does and evaluation is a lookup
+    if (oam_dirty || sprite_lines_height != get_sprite_height()) {
+        build_sprite_lines();
+    }
+    
+    const SpriteLine& line = sprite_lines[current_scanline];
     
-    uint8_t bitmap_low = memory->ppu_read(pattern_addr);
-    return bitmap_low;
+    for (int i = 0; i < SPRITES_SEC; i++) {
+        if (i < line.count) oam_sec[i] = oam[line.index[i]];
+        else oam_sec[i].ff();
+    }
+    sprites_found = line.count;
+    sprite_0_sec = line.sprite_0;
+    
+    if (line.overflow) {
+        set_overflow_flag(1);
+    }
 }
 
-uint8_t PPU::get_sprite_bitmap_high(Sprite sprite) {
-    uint16_t pattern_addr = get_sprite_pattern_table_addr();
-    pattern_addr += sprite.index << 3;
-    pattern_addr += (current_scanline + 1) % 8;
-    pattern_addr += 8;
+// bit i set when sprite i is on line, (line - Y) < height as a byte
+static uint64_t sprites_in_range(const std::array<uint8_t, SPRITES>& ys, uint8_t line, uint8_t height) {
+    uint64_t mask = 0;
+    
+#ifdef __SSE2__
+    const __m128i lines = _mm_set1_epi8((char) line);
+    const __m128i last = _mm_set1_epi8((char) (height - 1));
     
-    uint8_t bitmap_high = memory->ppu_read(pattern_addr);
-    return bitmap_high;
+    for (int i = 0; i < SPRITES; i += 16) {
+        __m128i y = _mm_loadu_si128((const __m128i*) (ys.data() + i));
+        __m128i distance = _mm_sub_epi8(lines, y);
+        // unsigned distance <= height - 1 exactly when min leaves it alone
+        __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(distance, last), distance);
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(in_range) << i;
+    }
+#else
+    for (int i = 0; i < SPRITES; i++) {
+        uint8_t distance = line - ys[i];
+        if (distance < height) mask |= (uint64_t) 1 << i;
+    }
+#endif
+    
+    return mask;
 }
 
-void PPU::render_pixel() {
-    uint16_t cycle = cycles % 341;
+void PPU::build_sprite_lines() {
+    uint8_t height = get_sprite_height();
     
-    if (cycle > 0 && cycle < 257) {
-        uint8_t background_pixel = get_background_pixel();
-        uint8_t sprite_pixel = get_sprite_pixel();
-                    
-        if (sprite_foreground || background_pixel == 0) {
-            pixel_array[current_scanline][cycle] = sprite_pixel;
-        } else {
-            pixel_array[current_scanline][cycle] = background_pixel;
-        }
+    std::array<uint8_t, SPRITES> ys;
+    for (int i = 0; i < SPRITES; i++) {
+        ys[i] = oam[i].Y;
+    }
+    
+    for (int line = 0; line < HEIGHT; line++) {
+        uint64_t mask = sprites_in_range(ys, line, height);
+        SpriteLine& entry = sprite_lines[line];
         
-        low_shift >>= 1;
-        high_shift >>= 1;
+        // the first 8 in oam order, a 9th sets overflow
+        entry.count = 0;
+        entry.sprite_0 = mask & 1;
+        while (mask && entry.count < SPRITES_SEC) {
+            entry.index[entry.count++] = __builtin_ctzll(mask);
+            mask &= mask - 1;
+        }
+        entry.overflow = mask != 0;
+    }
+    
+    sprite_lines_height = height;
+    oam_dirty = false;
+}
+
+uint16_t PPU::get_sprite_row(Sprite sprite) {
+    uint8_t row = current_scanline - sprite.Y;
+    uint16_t pattern_addr;
+    
+    if (get_sprite_height() == 16) {
+        // 8x16 sprites pick their table with bit 0 of the tile index
+        row &= 0xf;
+        if (sprite.vertical_flip()) row = 15 - row;
+        pattern_addr = ((sprite.index & 1) << 12) + ((sprite.index & 0xfe) << 4);
+        if (row > 7) pattern_addr += 16;
+    } else {
+        row &= 0x7;
+        if (sprite.vertical_flip()) row = 7 - row;
+        pattern_addr = get_sprite_pattern_table_addr() + (sprite.index << 4);
+    }
+    pattern_addr += row & 0x7;
+    
+    return fetch_row(pattern_addr, sprite.horizontal_flip());
+}
+
+void PPU::render_dot(uint16_t cycle, uint32_t actions) {
+    if (actions & DOT_PIXEL) {
+        render_pixel(cycle);
+    }
+    if (actions & DOT_FETCH) {
+        scanl_bkg(cycle, actions);
+    }
+    if (actions & DOT_SPRITES) {
+        scanl_spr(cycle, actions);
+    }
+}
+
+void PPU::render_pixel(uint16_t cycle) {
+    uint8_t x = cycle - 1;
+    uint8_t sprite_pixel = get_sprite_pixel(x);
+    bool visible = in_viewport(x);
+    
+    // outside the viewport the background only matters for sprite 0 hit
+    uint8_t background_pixel = 0;
+    if (visible || (sprite_pixel & SPRITE_0_PIXEL)) {
+        background_pixel = get_background_pixel(x);
+    }
+    
+    if ((sprite_pixel & SPRITE_0_PIXEL) && background_pixel && x != 255) {
+        set_sprite_0_hit_flag(1);
     }
+    
+    if (!visible) {
+        pattern_shift >>= 2;
+        palette_shift >>= 2;
+        return;
+    }
+    
+    // both are palette indices, 0 where transparent, which shows the backdrop
+    uint8_t index = 0;
+    if (sprite_pixel && (!(sprite_pixel & COMPOSE_BEHIND) || !background_pixel)) {
+        index = sprite_pixel & 0x1f;
+    } else if (background_pixel) {
+        index = background_pixel;
+    }
+    pixel_array[current_scanline][x] = memory->ppu_read(0x3f00 + index);
+    
+    pattern_shift >>= 2;
+    palette_shift >>= 2;
 }
 
-uint8_t PPU::get_background_pixel() {
-    uint8_t fx = (fine_x + cycles % 341) % 8;
-    uint8_t color_byte = ((low_shift >> fx) & 0x1) + (((high_shift >> fx) & 0x1) << 1);
-    bool even_x = (get_coarse_x() / 16) % 2;
-    bool even_y = (current_scanline / 16) % 2;
-    uint8_t shift = (((uint8_t) even_x) + (((uint8_t) even_y) << 1)) << 1;
-    uint8_t color_set = (attribute_byte >> shift) & 0x3;
+uint8_t PPU::get_background_pixel(uint8_t x) {
+    if (!get_background_flag() || (x < 8 && !get_background_left_flag())) {
+        return 0;
+    }
     
-    uint16_t color_addr = 0x3f00 + color_byte + (color_set << 2);
-    uint8_t palette_color = memory->ppu_read(color_addr);
+    uint8_t fx = fine_x * 2;
+    uint8_t color_byte = (pattern_shift >> fx) & 0x3;
+    uint8_t color_set = (palette_shift >> fx) & 0x3;
     
-    return palette_color;
+    if (color_byte == 0) {
+        return 0;
+    }
+    return (color_set << 2) | color_byte;
 }
 
-uint8_t PPU::get_sprite_pixel() {
+uint8_t PPU::get_sprite_pixel(uint8_t x) {
     //This function gets the next sprite pixel to be used for comparison with the background pixel when deciding the next pixel to display.
-    uint8_t return_pixel;
-    for (int i = 0; i < SPRITES_SEC; i++) {
-        uint8_t color = (sprite_bitmap_low[i] >> 7) + (sprite_bitmap_high[i] >> 7) * 2;
-        if (sprite_x[i] == 0) {
-            //Shifts sprite bitmaps
-            sprite_bitmap_low[i] = sprite_bitmap_low[i] << 1;
-            sprite_bitmap_high[i] = sprite_bitmap_high[i] << 1;	  
-            if (color != 0) {
-                //Sprite must be active and must have a non-transparent pixel
-          	  	return_pixel = memory->ppu_read(0x3F10 + 4 * (sprite_attributes[i] % 4) + color);
-	          	sprite_foreground = (((sprite_attributes[i] >> 5) & 0x1) == 1);
-                return return_pixel;
-	        }
-        }	   
-    }   
+    if (!get_sprite_flag() || (x < 8 && !get_sprite_left_flag())) {
+        return 0;
+    }
+    return sprite_line[x];
+}
+
+bool PPU::in_viewport(uint8_t x) {
+    return current_scanline >= view_top && current_scanline < view_bottom && x >= view_left && x < view_right;
+}
+
+void PPU::set_viewport(uint16_t left, uint16_t top, uint16_t right, uint16_t bottom) {
+    if (left >= right || top >= bottom || right > WIDTH || bottom > HEIGHT) {
+        throw std::invalid_argument("invalid viewport");
+    }
+    
+    view_left = left;
+    view_top = top;
+    view_right = right;
+    view_bottom = bottom;
+    
+    // what's outside is never drawn again, so it's left blank
+    for (auto& row : pixel_array) {
+        row.fill(0);
+    }
+}
+
+// scanline renderer
+
+void PPU::set_render_mode(uint8_t mode) {
+    catch_up();
+    render_mode = mode;
+    
+    // dots already drawn on this line stay drawn
+    line_dot = dot ? dot : 1;
+}
+
+void PPU::catch_up() {
+    // called before anything that can see or change what a deferred dot draws
+    if (render_mode == RENDER_SCANLINE && (dot_actions[line_kinds[current_scanline]][dot] & DOT_PIXEL)) {
+        draw_dots(dot);
+    }
+}
+
+void PPU::draw_dots(uint16_t end) {
+    if (line_dot < end && is_rendering_enabled()) {
+        // the dot path sees hits itself from here on, the prediction was
+        // made from state the cpu may be about to change
+        sprite_0_dot = 0;
+        
+        for (uint16_t i = line_dot; i < end; i++) {
+            render_dot(i, dot_actions[LINE_VISIBLE][i]);
+        }
+    }
+    if (line_dot < end) {
+        line_dot = end;
+    }
+}
+
+void PPU::finish_line() {
+    // the background fetches must not move A12, the mapper would hear the
+    // edge at the wrong time, so those lines take the dot path too
+    bool a12 = get_background_pattern_table_addr() & 0x1000;
+    
+    if (line_dot == 1 && is_rendering_enabled() && a12 == a12_high) {
+        render_scanline();
+        line_dot = 257;
+    } else {
+        draw_dots(257);
+    }
+}
+
+void PPU::render_scanline() {
+    // leaves the same pixels and state behind as dots 1-256 of the dot path
+    std::array<uint16_t, 34> rows;
+    std::array<uint8_t, 34> sets;
+    
+    // the first two tiles were prefetched at the end of the last line
+    rows[0] = pattern_shift;
+    rows[1] = pattern_shift >> 16;
+    sets[0] = palette_shift & 0x3;
+    sets[1] = (palette_shift >> 16) & 0x3;
+    
+    uint16_t base_bkg_addr = get_background_pattern_table_addr();
+    
+    for (int tile = 2; tile < 34; tile++) {
+        nametable_byte = memory->ppu_read(get_tile_address());
+        attribute_byte = memory->ppu_read(get_attribute_address());
+        bkg_addr = base_bkg_addr + (((uint16_t) nametable_byte) << 4) + get_fine_y();
+        pattern_row = memory->ppu_read_row(bkg_addr, false);
+        
+        uint8_t shift = ((vram_addr >> 4) & 0x4) | (vram_addr & 0x2);
+        rows[tile] = pattern_row;
+        sets[tile] = (attribute_byte >> shift) & 0x3;
+        
+        if (tile != 33) inc_coarse_x();
+        else inc_fine_y();
+    }
+    
+    pattern_shift = rows[32] | ((uint32_t) rows[33] << 16);
+    palette_shift = (sets[32] * 0x5555) | ((uint32_t) (sets[33] * 0x5555) << 16);
+    
+    if (current_scanline >= view_top && current_scanline < view_bottom) {
+        compose_scanline(rows, sets);
+    }
+    
+    evaluate_sprites();
+}
+
+void PPU::compose_scanline(const std::array<uint16_t, 34>& rows, const std::array<uint8_t, 34>& sets) {
+    // the line starts fine_x pixels into the first tile
+    std::array<uint8_t, 34 * 8> background;
+    compose_tiles(rows.data(), sets.data(), 34, background.data());
+    uint8_t* background_line = background.data() + fine_x;
+    
+    std::array<uint8_t, WIDTH> sprites = sprite_line;
+    
+    // PPUMASK hides either layer, or just its leftmost 8 pixels
+    if (!get_background_flag()) {
+        std::fill(background_line, background_line + WIDTH, 0);
+    } else if (!get_background_left_flag()) {
+        std::fill(background_line, background_line + 8, 0);
+    }
+    if (!get_sprite_flag()) {
+        sprites.fill(0);
+    } else if (!get_sprite_left_flag()) {
+        std::fill(sprites.begin(), sprites.begin() + 8, 0);
+    }
+    
+    std::array<uint8_t, 32> palette;
+    for (int i = 0; i < 32; i++) {
+        palette[i] = memory->ppu_read(0x3f00 + i);
+    }
+    
+    uint16_t x = view_left;
+    compose_line(background_line + x, sprites.data() + x, palette.data(), pixel_array[current_scanline].data() + x, view_right - x);
 }
 
 void PPU::execute() {
     //Our main cycle execution function for PPU. Every time this is called, a cycle of PPU is executed.
-    bool render = is_rendering_enabled();
-    if (current_scanline >= 0 && current_scanline < 240) { 
-        if (render) {
-            render_pixel();
-            decrement_sprite_counter();
-            scanl_bkg();
-            scanl_spr();
+    uint32_t actions = dot_actions[line_kinds[current_scanline]][dot];
+    
+    if (actions) {
+        bool render = is_rendering_enabled();
+        
+        if (actions & DOT_LINE_START) {
+            line_emphasis[current_scanline] = regs[1] >> 5;
         }
         
-    } else if (current_scanline == 261) {
-        //Pre-render scanline fills the 2 16-bit background tile registers and sets VBLANK and sprite 0 hit flags and sprite overflow flags to 0.
-        if (cycles % 341 == 1) {
+        // clears VBLANK, sprite 0 hit and sprite overflow
+        if (actions & DOT_CLEAR_FLAGS) {
             set_vblank_flag(0);
             set_sprite_0_hit_flag(0);
             set_overflow_flag(0);
+            
+            // nothing is evaluated for line 0, the pre-render fetches find
+            // secondary oam empty rather than what line 239 left there
+            for (Sprite& sprite : oam_sec) {
+                sprite.ff();
+            }
+            sprites_found = 0;
+            sprite_0_sec = false;
         }
         
-        
-        if (render) {
-            scanl_bkg();
+        if (render_mode == RENDER_SCANLINE && (actions & DOT_PIXEL)) {
+            if (actions & DOT_LINE_START) {
+                line_dot = 1;
+                if (render) predict_sprite_0_hit();
+            }
+            
+            // the hit lands on its own dot even though the line is drawn later
+            if (dot == sprite_0_dot) {
+                set_sprite_0_hit_flag(1);
+                sprite_0_dot = 0;
+            }
+            
+            if (dot == 256) finish_line();
+        } else if (render && (actions & DOT_RENDER)) {
+            render_dot(dot, actions);
         }
         
-        if (cycles > 279 && cycles < 305 && render) {
-            // set vertical bits
-            vram_addr &= ~0x7be0; 
-            vram_addr |= temp_vram_addr & 0x7be0; 
+        // both renderers are done with the line by now
+        if (actions & DOT_HASH) {
+            hash_line();
         }
         
-        if (cycles % 341 == 340) {
-            display();
+        if (actions & DOT_SET_VBLANK) {
+            set_vblank_flag(1);
         }
         
-    } else if (current_scanline == 241) {
-        if (cycles % 341 == 1)
-            // Cycle 1 on 241st scanline sets VBLANK flag to 1.
-            set_vblank_flag(1);
+        if (actions & DOT_END_FRAME) {
+            end_frame();
+        }
     }
     
-    
     inc_cycle();
     
     uint64_t cpu_clock = memory->get_cpu_cycle();
@@ -619,6 +1024,37 @@ void PPU::execute() {
     }        
 }
 
+void PPU::run(uint64_t dots) {
+    // register writes only come between calls, so whether rendering is on
+    // can't change while idle dots are skipped
+    while (dots > 0) {
+        bool render = is_rendering_enabled();
+        uint16_t next = next_dots[render][line_kinds[current_scanline]][dot];
+        
+        uint64_t idle;
+        if (next < DOTS) {
+            idle = next - dot;
+        } else {
+            // the rest of the line, whole idle lines, then up to the first stop
+            uint16_t line = next_lines[current_scanline];
+            uint16_t lines = line > current_scanline ? line - current_scanline : line + SCANLINES - current_scanline;
+            idle = (DOTS - dot) + (uint64_t) (lines - 1) * DOTS + next_dots[render][line_kinds[line]][0];
+        }
+        
+        if (idle >= dots) {
+            skip_dots(dots);
+            return;
+        }
+        if (idle) {
+            skip_dots(idle);
+            dots -= idle;
+        }
+        
+        execute();
+        dots--;
+    }
+}
+
 void PPU::clear_writes() {
     regs[0] = 0;
     regs[1] = 0;
@@ -629,182 +1065,215 @@ void PPU::clear_writes() {
     fine_x = 0;
 }
 
-void PPU::display() {
-    //This function uses the SDL2 library to display the pixel array in a window.
-    uint32_t* pixels = get_pixel_array();
-    SDL_UpdateTexture(screen, NULL, pixels, WIDTH * sizeof(uint32_t));
+void PPU::hash_line() {
+    // emphasis is part of what ends up on screen, so it seeds the hash
+    line_hashes[current_scanline] = hash64(pixel_array[current_scanline].data(), WIDTH, line_emphasis[current_scanline]);
+}
+
+void PPU::end_frame() {
+    uint64_t hash = hash64((const uint8_t*) line_hashes.data(), HEIGHT * sizeof(uint64_t));
+    frame_changed = hash != frame_hash;
+    frame_hash = hash;
+    frame_count++;
     
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, screen, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    if (keep_frame) {
+        expand_frame(kept_frame.data(), WIDTH * sizeof(uint32_t));
+    }
+    if (observer) {
+        observer->push(&pixel_array[0][0]);
+    }
+    if (capture) {
+        capture->push(&pixel_array[0][0], line_emphasis.data());
+    }
+    if (present) {
+        display();
+    }
+    if (debug_view) {
+        debug_view->present();
+        if (debug_view->wants_snapshot()) {
+            capture_debug();
+        }
+    }
 }
 
-uint32_t* PPU::get_pixel_array() {
-    uint32_t* pixels = new uint32_t[WIDTH * HEIGHT];
-    for (int Y = 0; Y < HEIGHT; Y++) { // Y
-        for (int X = 0; X < WIDTH; X++) { // X
-            uint8_t val = pixel_array[Y][X];
-            pixels[ADDR(X,Y)] = convert32(val);
+void PPU::capture_debug() {
+    for (int i = 0; i < 4; i++) {
+        std::array<uint8_t, NAMETABLE> nametable = memory->get_nametable(i);
+        std::copy(nametable.begin(), nametable.end(), debug_snapshot.nametables.begin() + i * NAMETABLE);
+    }
+    for (int i = 0; i < 2; i++) {
+        std::array<uint8_t, PATTERN_TABLE> table = memory->get_pattern_table(i);
+        std::copy(table.begin(), table.end(), debug_snapshot.chr.begin() + i * PATTERN_TABLE);
+    }
+    for (int i = 0; i < SPRITES; i++) {
+        for (int byte = 0; byte < 4; byte++) {
+            debug_snapshot.oam[i * 4 + byte] = oam[i].byte(byte);
         }
     }
+    for (int i = 0; i < DEBUG_PALETTE; i++) {
+        debug_snapshot.palette[i] = memory->ppu_read(0x3f00 + i);
+    }
+    debug_snapshot.ctrl = regs[0];
     
-    return pixels;
+    debug_view->publish(debug_snapshot);
 }
 
-uint32_t PPU::convert32(uint8_t value) {
-    value &= 0x3f;
-    uint32_t color = color_map[value];
-    // because I'm dumb
-    color >>= 8;
-    color += 0xFF000000;
-    return color;
+void PPU::set_debug_view(bool open) {
+    if (!open) {
+        // joins the viewer thread and closes its window
+        debug_view.reset();
+    } else if (!debug_view) {
+        debug_view = std::make_shared<DebugView>(palette_lut.data());
+    }
 }
 
-std::string PPU::debug() {
-    std::stringstream buffer;
-    
-    buffer << "PPU: " << std::setw(3) << cycles % 341 << ", " << std::setw(3) << current_scanline;
-    
-    return buffer.str();
+bool PPU::is_debug_view_open() {
+    return debug_view != nullptr;
+}
+
+uint32_t PPU::get_debug_view_window() {
+    return debug_view ? debug_view->get_window_id() : 0;
+}
+
+uint64_t PPU::get_frame_hash() {
+    return frame_hash;
+}
+
+bool PPU::is_frame_changed() {
+    return frame_changed;
+}
+
+uint64_t PPU::get_frame_count() {
+    return frame_count;
 }
 
-// render nametable
-void PPU::kmsv1() {
-    SDL_Window* nt_window = SDL_CreateWindow("NAMETABLE", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
-    if (nt_window == NULL) {
-        throw std::runtime_error(SDL_GetError());
+void PPU::set_keep_frame(bool keep) {
+    keep_frame = keep;
+}
+
+const uint32_t* PPU::get_kept_frame() {
+    return kept_frame.data();
+}
+
+void PPU::set_ntsc(bool enabled) {
+    if (enabled && !ntsc) {
+        ntsc = std::make_shared<NtscFilter>();
+        ntsc_screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, NTSC_WIDTH, HEIGHT);
+        // lines are doubled to keep the shape of the picture
+        SDL_SetWindowSize(window, NTSC_WIDTH, HEIGHT * 2);
+    } else if (!enabled && ntsc) {
+        ntsc.reset();
+        SDL_DestroyTexture(ntsc_screen);
+        ntsc_screen = nullptr;
+        SDL_SetWindowSize(window, WIDTH, HEIGHT);
     }
     
-    SDL_Renderer* nt_draw = SDL_CreateRenderer(nt_window, -1, 0);
-    SDL_Texture* nt_screen = SDL_CreateTexture(nt_draw, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, WIDTH, HEIGHT);
-    uint32_t* pixels = new uint32_t[WIDTH * HEIGHT];
-    
-    std::array<uint8_t, NAMETABLE> nametable = memory->get_nametable(0);
-    
-    std::array<uint8_t, PATTERN_TABLE> left = memory->get_pattern_table(0);
-    std::array<uint8_t, PATTERN_TABLE> right = memory->get_pattern_table(0);
-    
-    std::array<std::array<uint8_t, PALETTE>, 4> palettes = memory->get_back_palettes();
-    
-    uint8_t univ_color = memory->get_univ_back_color();
+    // the new texture is empty until the next frame is drawn into it
+    uploaded = false;
+}
+
+void PPU::start_capture(const char* filename, uint8_t format) {
+    capture = std::make_shared<Capture>(filename, format, palette_lut.data());
+}
+
+void PPU::stop_capture() {
+    // waits for the writer to finish what's queued
+    capture.reset();
+}
+
+void PPU::set_present(bool present) {
+    this->present = present;
+}
+
+void PPU::set_observation(const ObserveConfig& config) {
+    observer = std::make_shared<Observer>(config, color_map.data());
+}
+
+size_t PPU::get_observation_size() {
+    if (!observer) {
+        return 0;
+    }
+    return observer->get_size();
+}
+
+void PPU::observe(uint8_t* out) {
+    if (!observer) {
+        throw std::runtime_error("no observation configured");
+    }
+    observer->read(out);
+}
+
+void PPU::display() {
+    //This function uses the SDL2 library to display the pixel array in a window.
+    SDL_Texture* target = ntsc ? ntsc_screen : screen;
     
-    for (int y = 0; y < HEIGHT; y++) {
-        for (int x = 0; x < WIDTH; x++) {
-            uint16_t nt_index = (x + y * WIDTH) / 8;
-            uint8_t nt_byte = nametable[nt_index];
-            
-            uint8_t attr_y_offset = y / 32;
-            uint8_t attr_x_offset = x / 32;
-            
-            uint8_t attr_byte = nametable[960 + attr_x_offset + attr_y_offset * 8];
-            
-            bool even_x = (x / 16) % 2;
-            bool even_y = (y / 16) % 2;
-            uint8_t shift = (((uint8_t) even_x) + (((uint8_t) even_y) << 1)) << 1;
-            
-            uint8_t color_set = (attr_byte >> shift) & 0x3;
-            
-            uint8_t pt_index = (((uint16_t) nt_byte) << 4 + y % 8);
-            uint8_t low_byte;
-            uint8_t high_byte;
-            
-            if (pt_index < 0x1000) {
-                low_byte = left[pt_index];
-                high_byte = left[pt_index + 8];
-            } else {
-                low_byte = right[pt_index];
-                high_byte = right[pt_index + 8];
-            }
-            
-            uint8_t color_index = ((low_byte >> (7 - x % 8)) & 1) + (((high_byte >> (7 - x % 8)) & 1) << 1);
-            
-            uint8_t color_8;
-            
-            if (color_index == 0) {
-                color_8 = univ_color;
-            } else {
-                color_8 = palettes[color_set][color_index - 1];
-            }
-            
-            uint32_t color_32 = convert32(color_8);
-            pixels[ADDR(x,y)] = color_32;
+    // the texture keeps the last frame it was given, so that one isn't uploaded again
+    if (!uploaded || uploaded_hash != frame_hash) {
+        void* pixels;
+        int pitch;
+        if (SDL_LockTexture(target, NULL, &pixels, &pitch) < 0) {
+            throw std::runtime_error(SDL_GetError());
         }
+        if (ntsc) {
+            ntsc->filter(&pixel_array[0][0], line_emphasis.data(), (uint32_t*) pixels, pitch);
+        } else {
+            expand_frame((uint32_t*) pixels, pitch);
+        }
+        SDL_UnlockTexture(target);
+        uploaded_hash = frame_hash;
+        uploaded = true;
     }
     
-    SDL_UpdateTexture(nt_screen, NULL, pixels, WIDTH * sizeof(uint32_t));
-    
-    SDL_RenderClear(nt_draw);
-    SDL_RenderCopy(nt_draw, nt_screen, NULL, NULL);
-    SDL_RenderPresent(nt_draw);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, target, NULL, NULL);
+    SDL_RenderPresent(renderer);
 }
 
-// render pattern table
-void PPU::kmsv2() {
-    SDL_Window* pt_window = SDL_CreateWindow("PATTERN TABLE", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
-    if (pt_window == NULL) {
-        throw std::runtime_error(SDL_GetError());
+void PPU::expand_frame(uint32_t* out, int pitch) {
+    for (int y = 0; y < HEIGHT; y++) {
+        const uint32_t* lut = palette_lut.data() + line_emphasis[y] * 64;
+        uint32_t* row = (uint32_t*) ((uint8_t*) out + y * pitch);
+        compose_expand(pixel_array[y].data(), lut, row, WIDTH);
     }
-    
-    SDL_Renderer* pt_draw = SDL_CreateRenderer(pt_window, -1, 0);
-    SDL_Texture* pt_screen = SDL_CreateTexture(pt_draw, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, WIDTH, HEIGHT);
-    uint32_t* pixels = new uint32_t[WIDTH * HEIGHT];
-    
-    std::array<uint8_t, PATTERN_TABLE> left = memory->get_pattern_table(0);
-    std::array<uint8_t, PATTERN_TABLE> right = memory->get_pattern_table(1);
-    
-    std::array<std::array<uint8_t, PALETTE>, 4> palettes = memory->get_back_palettes();
-    uint8_t univ_color = memory->get_univ_back_color();
-    
-    for (int y = 0; y < 16; y++) {
-        
-        for (int x = 0; x < 16; x++) {
-            uint16_t tile_index = (y << 8) + (x << 4);
-            
-            for (int fy = 0; fy < 8; fy++) {
-                uint16_t actual_index = tile_index + fy;
-                
-                uint8_t left_low = left[actual_index];
-                uint8_t left_high = left[actual_index + 8];
-                
-                uint8_t right_low = right[actual_index];
-                uint8_t right_high = right[actual_index + 8];
-                
-                for (int fx = 0; fx < 8; fx++) {
-                    // draw left
-                    uint8_t left_color_index = ((left_low >> (7 - fx)) & 1) + (((left_high >> (7 - fx)) & 1) << 1);
-                    uint8_t left_color_8;
-            
-                    if (left_color_index == 0) {
-                        left_color_8 = univ_color;
-                    } else {
-                        left_color_8 = palettes[0][left_color_index - 1];
-                    }
-                    
-                    uint32_t left_color_32 = convert32(left_color_8);
-                    
-                    // draw right
-                    uint8_t right_color_index = ((right_low >> (7 - fx)) & 1) + (((right_high >> (7 - fx)) & 1) << 1);
-                    uint8_t right_color_8;
+}
+
+void PPU::build_palette_lut() {
+    // every colour under each of the 8 PPUMASK emphasis combinations, the
+    // channels that aren't emphasised are dimmed
+    for (int emphasis = 0; emphasis < EMPHASIS_LEVELS; emphasis++) {
+        for (int value = 0; value < 64; value++) {
+            uint32_t color = convert32(value);
             
-                    if (right_color_index == 0) {
-                        right_color_8 = univ_color;
-                    } else {
-                        right_color_8 = palettes[0][right_color_index - 1];
-                    }
-                    
-                    uint32_t right_color_32 = convert32(right_color_8);
-                    
-                    // put
-                    pixels[(y * 8 + fy) * WIDTH + x * 8 + fx] = left_color_32;
-                    pixels[(y * 8 + fy) * WIDTH + x * 8 + fx + 128] = right_color_32;
+            // the blacks in columns $E and $F aren't affected
+            if (emphasis && (value & 0x0e) != 0x0e) {
+                for (int channel = 0; channel < 3; channel++) {
+                    // red is bit 0 of the emphasis bits, and the high byte here
+                    if (emphasis & (1 << channel)) continue;
+                    int shift = 16 - channel * 8;
+                    uint32_t level = (color >> shift) & 0xff;
+                    level = level * EMPHASIS_DIM / 1000;
+                    color = (color & ~(0xff << shift)) | (level << shift);
                 }
             }
+            
+            palette_lut[emphasis * 64 + value] = color;
         }
     }
+}
+
+uint32_t PPU::convert32(uint8_t value) {
+    value &= 0x3f;
+    uint32_t color = color_map[value];
+    // because I'm dumb
+    color >>= 8;
+    color += 0xFF000000;
+    return color;
+}
+
+std::string PPU::debug() {
+    std::stringstream buffer;
     
-    SDL_UpdateTexture(pt_screen, NULL, pixels, WIDTH * sizeof(uint32_t));
+    buffer << "PPU: " << std::setw(3) << dot << ", " << std::setw(3) << current_scanline;
     
-    SDL_RenderClear(pt_draw);
-    SDL_RenderCopy(pt_draw, pt_screen, NULL, NULL);
-    SDL_RenderPresent(pt_draw);
+    return buffer.str();
 }
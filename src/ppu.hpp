@@ -10,6 +10,10 @@
 #include <string>
 #include <SDL.h>
 #include "mem.hpp"
+#include "observe.hpp"
+#include "debugview.hpp"
+#include "ntsc.hpp"
+#include "capture.hpp"
 
 #define SPRITES 0x40
 #define SPRITES_SEC 8
@@ -17,8 +21,63 @@
 #define RIGHT 0xFFF
 #define REGS 8
 
+// A12 has to stay low this many dots before a rise is passed on, which keeps
+// the sprite fetches from clocking the MMC3 counter eight times per line
+#define A12_FILTER 9
+
+// sprite line buffer entries are a palette index, COMPOSE_BEHIND and this
+#define SPRITE_0_PIXEL  0x40
+
+// renderers, picked with set_render_mode
+#define RENDER_DOT      0
+#define RENDER_SCANLINE 1
+
 #define WIDTH           256
 #define HEIGHT          240
+
+// timing, a frame is 262 lines of 341 dots
+#define DOTS            341
+#define SCANLINES       262
+
+// kinds of line, each with its own row of dot actions
+#define LINE_VISIBLE    0
+#define LINE_IDLE       1
+#define LINE_VBLANK     2
+#define LINE_PRE_RENDER 3
+#define LINE_KINDS      4
+
+// what a dot does, looked up instead of worked out from the dot number
+#define DOT_PIXEL        0x00001
+#define DOT_NAMETABLE    0x00002
+#define DOT_ATTRIBUTE    0x00004
+#define DOT_PATTERN      0x00008
+#define DOT_RELOAD       0x00010
+#define DOT_INC_X        0x00020
+#define DOT_INC_Y        0x00040
+#define DOT_COPY_X       0x00080
+#define DOT_COPY_Y       0x00100
+#define DOT_EVALUATE     0x00200
+#define DOT_SPRITE_FETCH 0x00400
+#define DOT_SPRITE_LINE  0x00800
+#define DOT_LINE_START   0x01000
+#define DOT_HASH         0x02000
+#define DOT_CLEAR_FLAGS  0x04000
+#define DOT_SET_VBLANK   0x08000
+#define DOT_END_FRAME    0x10000
+
+// the steps that only happen while rendering is on
+#define DOT_FETCH   (DOT_NAMETABLE | DOT_ATTRIBUTE | DOT_PATTERN | DOT_RELOAD | DOT_INC_X | DOT_INC_Y | DOT_COPY_X | DOT_COPY_Y)
+#define DOT_SPRITES (DOT_EVALUATE | DOT_SPRITE_FETCH | DOT_SPRITE_LINE)
+#define DOT_RENDER  (DOT_PIXEL | DOT_FETCH | DOT_SPRITES)
+
+// the dots still worth stopping on with rendering off, the scanline
+// renderer keeps its place in the line at dots 1 and 256
+#define DOT_STOPS_OFF (DOT_LINE_START | DOT_EVALUATE | DOT_HASH | DOT_CLEAR_FLAGS | DOT_SET_VBLANK | DOT_END_FRAME)
+
+// PPUMASK colour emphasis, the 3 bits pick one of 8 copies of the palette.
+// Channels left out are scaled by EMPHASIS_DIM / 1000.
+#define EMPHASIS_LEVELS 8
+#define EMPHASIS_DIM    816
 #define ADDR(X, Y) (Y * WIDTH + X)
 
 #define NAMETABLE_ADDR() (get_nametable_index() * NAMETABLE + 0x2000)
@@ -30,6 +89,14 @@
 
 class Mem;
 
+// sprites evaluation finds on one line, by oam index
+struct SpriteLine {
+    uint8_t count;
+    bool overflow;
+    bool sprite_0;
+    std::array<uint8_t, SPRITES_SEC> index;
+};
+
 struct Sprite{
     uint8_t Y;
     uint8_t index;
@@ -66,17 +133,33 @@ private:
     uint16_t temp_vram_addr;
     uint8_t fine_x;
     uint8_t write_toggle;
-    uint16_t high_shift, low_shift;
-    uint8_t palette_attribute_1, palette_attribute_2;
+    // two tiles of chunky pixels (2 bits each) and their palettes, the
+    // current tile in the low half
+    uint32_t pattern_shift = 0;
+    uint32_t palette_shift = 0;
     
     // sprites
     std::array<Sprite, SPRITES> oam;
     std::array<Sprite, SPRITES_SEC> oam_sec;
-    std::array<uint8_t, SPRITES_SEC> sprite_bitmap_low;
-    std::array<uint8_t, SPRITES_SEC> sprite_bitmap_high;
+    std::array<uint16_t, SPRITES_SEC> sprite_rows;
     std::array<uint8_t, SPRITES_SEC> sprite_attributes;
     std::array<uint8_t, SPRITES_SEC> sprite_x;
-    void decrement_sprite_counter();
+    
+    // the next line's sprite pixels, built once the fetches are done
+    std::array<uint8_t, WIDTH> sprite_line;
+    bool sprite_0_sec = false;
+    void build_sprite_line();
+    
+    // dot the scanline renderer expects sprite 0 to hit on, 0 for none
+    uint16_t sprite_0_dot = 0;
+    uint16_t peek_background_row(uint8_t tile);
+    void predict_sprite_0_hit();
+    
+    // evaluation results for every line, rebuilt after oam changes
+    std::array<SpriteLine, HEIGHT> sprite_lines;
+    uint8_t sprite_lines_height = 0;
+    bool oam_dirty = true;
+    void build_sprite_lines();
 
     // Determines whether x or y coordinate is set next. If false, x-coordinate. If true, y-coordinate.
     bool addr_latch = false;
@@ -86,20 +169,34 @@ private:
     uint8_t sprite_tile_latch;
     uint8_t sprite_y_latch;
 
-    // timing
+    // timing, cycles keeps counting while dot and scanline wrap
     uint64_t cycles = 0;
+    uint16_t dot = 0;
     uint16_t current_scanline = 0;
     
     // latches
     uint8_t nametable_byte;
-    bool sprite_foreground;
     uint8_t attribute_byte;
     
     void inc_cycle();
     void inc_scanline();
+    void skip_dots(uint64_t count);
 
     std::array<std::array<uint8_t, 256>, 240> pixel_array;
     std::array<uint32_t, 64> color_map = PALETTE_32;
+    // ARGB for each colour and emphasis, and the emphasis each line was drawn with
+    std::array<uint32_t, 64 * EMPHASIS_LEVELS> palette_lut;
+    std::array<uint8_t, HEIGHT> line_emphasis;
+    
+    // each line is hashed once it's drawn, the frame hash is made from those
+    std::array<uint64_t, HEIGHT> line_hashes;
+    uint64_t frame_hash = 0;
+    bool frame_changed = true;
+    void hash_line();
+    
+    // what the screen texture holds, which lags the frame while presenting is off
+    uint64_t uploaded_hash = 0;
+    bool uploaded = false;
         
     // PPUCTRL info
     uint16_t get_base_nametable_addr();
@@ -137,24 +234,42 @@ private:
     
     // rendering
     uint16_t bkg_addr;
-    uint8_t low_pattern;
-    uint8_t high_pattern;
-    Sprite sprite_buffer;
-    uint8_t n = 0;
-    uint8_t m = 0;
+    uint16_t pattern_row;
     uint8_t sprites_found = 0;
     
     uint16_t get_tile_address();
     uint16_t get_attribute_address();
     
-    uint8_t get_sprite_bitmap_low(Sprite sprite);
-    uint8_t get_sprite_bitmap_high(Sprite sprite);
+    // pattern fetches, tracking PPU A12 for scanline counters
+    bool a12_high = false;
+    uint64_t a12_low_cycle = 0;
+    uint16_t fetch_row(uint16_t addr, bool flip);
+    
+    uint16_t get_sprite_row(Sprite sprite);
+    
+    void scanl_bkg(uint16_t cycle, uint32_t actions);
+    void scanl_spr(uint16_t cycle, uint32_t actions);
+    void evaluate_sprites();
+    void render_dot(uint16_t cycle, uint32_t actions);
+    void render_pixel(uint16_t cycle);
+    uint8_t get_sprite_pixel(uint8_t x);
+    uint8_t get_background_pixel(uint8_t x);
     
-    void scanl_bkg();
-    void scanl_spr();
-    void render_pixel();
-    uint8_t get_sprite_pixel();
-    uint8_t get_background_pixel();
+    // scanline renderer, dots 1-256 of a visible line are put off until
+    // dot 256 and drawn in one go unless the cpu looks at the ppu before
+    uint8_t render_mode = RENDER_DOT;
+    uint16_t line_dot = 1;
+    void draw_dots(uint16_t end);
+    void finish_line();
+    void render_scanline();
+    void compose_scanline(const std::array<uint16_t, 34>& rows, const std::array<uint8_t, 34>& sets);
+    
+    // only pixels inside are composed, fetches and sprites carry on outside
+    uint16_t view_left = 0;
+    uint16_t view_top = 0;
+    uint16_t view_right = WIDTH;
+    uint16_t view_bottom = HEIGHT;
+    bool in_viewport(uint8_t x);
     
     void inc_fine_x();
     
@@ -163,24 +278,64 @@ private:
     SDL_Renderer* renderer;
     SDL_Texture* screen;
     
-    uint32_t* get_pixel_array();
+    // composite look, drawn to a wider texture of its own
+    std::shared_ptr<NtscFilter> ntsc;
+    SDL_Texture* ntsc_screen = nullptr;
+    
+    void expand_frame(uint32_t* out, int pitch);
+    void build_palette_lut();
     uint32_t convert32(uint8_t value);
     
     // startup
     void clear_writes();
     
+    // frame outputs, the window is optional when something observes
+    std::shared_ptr<Observer> observer;
+    std::shared_ptr<Capture> capture;
+    bool present = true;
+    uint64_t frame_count = 0;
+    void end_frame();
+    
+    // the last finished frame as ARGB, kept only when asked for
+    bool keep_frame = false;
+    std::array<uint32_t, WIDTH * HEIGHT> kept_frame;
+    
+    // vram viewer, only given a snapshot when it's done with the last one
+    std::shared_ptr<DebugView> debug_view;
+    DebugSnapshot debug_snapshot;
+    void capture_debug();
+    
 public:
     PPU(std::shared_ptr<Mem> memory, SDL_Window* window);
     ~PPU();
     void set_oam(uint8_t byte);
+    void set_render_mode(uint8_t mode);
+    void set_viewport(uint16_t left, uint16_t top, uint16_t right, uint16_t bottom);
+    void catch_up();
     uint16_t get_vram_addr();
     void ext_reg_write(uint64_t index, uint8_t value);
     uint8_t ext_reg_read(uint64_t index);
 
     void execute();
+    void run(uint64_t dots);
     void display();
-    void kmsv1();
-    void kmsv2();
+    
+    void set_ntsc(bool enabled);
+    void start_capture(const char* filename, uint8_t format);
+    void stop_capture();
+    void set_present(bool present);
+    void set_observation(const ObserveConfig& config);
+    size_t get_observation_size();
+    void observe(uint8_t* out);
+    uint64_t get_frame_hash();
+    bool is_frame_changed();
+    uint64_t get_frame_count();
+    void set_keep_frame(bool keep);
+    const uint32_t* get_kept_frame();
+    void set_debug_view(bool open);
+    bool is_debug_view_open();
+    // SDL window id of the viewer, 0 when it's closed
+    uint32_t get_debug_view_window();
     
     std::string debug();
 };
@@ -0,0 +1,355 @@
+#include "regress.hpp"
+#include "nes.hpp"
+#include "hash.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+static const char* const button_names[8] = {"a", "b", "select", "start", "up", "down", "left", "right"};
+
+// manifest
+
+static uint8_t parse_button(const std::string& name, size_t line) {
+    for (uint8_t i = 0; i < 8; i++) {
+        if (name == button_names[i]) {
+            return i;
+        }
+    }
+    throw std::invalid_argument("unknown button on manifest line " + std::to_string(line + 1));
+}
+
+static std::vector<RegressCase> read_manifest(const std::vector<std::string>& lines, const std::string& base) {
+    std::vector<RegressCase> cases;
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        std::istringstream stream(lines[i].substr(0, lines[i].find('#')));
+        std::string command;
+        if (!(stream >> command)) {
+            continue;
+        }
+
+        if (command == "rom") {
+            RegressCase test;
+            stream >> test.name;
+            test.rom = test.name[0] == '/' ? test.name : base + test.name;
+            test.render_mode = RENDER_DOT;
+            cases.push_back(test);
+            continue;
+        }
+
+        RegressStep step = {};
+        step.line = i;
+        std::string argument;
+        if (cases.empty() || !(stream >> step.frame >> argument)) {
+            throw std::invalid_argument("bad manifest line " + std::to_string(i + 1));
+        }
+
+        if (command == "press" || command == "release") {
+            step.action = command == "press" ? REGRESS_PRESS : REGRESS_RELEASE;
+            step.button = parse_button(argument, i);
+        } else if (command == "check") {
+            step.action = REGRESS_CHECK;
+            step.known = argument != "-";
+            if (step.known) {
+                step.hash = std::stoull(argument, nullptr, 16);
+            }
+        } else {
+            throw std::invalid_argument("bad manifest line " + std::to_string(i + 1));
+        }
+        cases.back().steps.push_back(step);
+    }
+
+    for (RegressCase& test : cases) {
+        std::stable_sort(test.steps.begin(), test.steps.end(), [](const RegressStep& a, const RegressStep& b) {
+            return a.frame < b.frame;
+        });
+    }
+    return cases;
+}
+
+static std::string case_label(const RegressCase& test) {
+    return test.render_mode == RENDER_SCANLINE ? test.name + " --scanline" : test.name;
+}
+
+static std::string to_hex64(uint64_t value) {
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) value);
+    return buffer;
+}
+
+// PNG, 8 bit RGB with no filtering, deflated by zlib
+
+static void put32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(value >> shift);
+    }
+}
+
+static void put_chunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    put32(out, data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put32(out, crc32_ieee(out.data() + start, out.size() - start));
+}
+
+static void write_png(const std::string& filename, const uint32_t* pixels, int width, int height) {
+    std::vector<uint8_t> raw;
+    raw.reserve((width * 3 + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        for (int x = 0; x < width; x++) {
+            uint32_t color = pixels[y * width + x];
+            raw.push_back(color >> 16);
+            raw.push_back(color >> 8);
+            raw.push_back(color);
+        }
+    }
+
+    uLongf size = compressBound(raw.size());
+    std::vector<uint8_t> deflated(size);
+    if (compress(deflated.data(), &size, raw.data(), raw.size()) != Z_OK) {
+        throw std::runtime_error("could not compress png");
+    }
+    deflated.resize(size);
+
+    std::vector<uint8_t> header;
+    put32(header, width);
+    put32(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    std::vector<uint8_t> out(signature, signature + 8);
+    put_chunk(out, "IHDR", header);
+    put_chunk(out, "IDAT", deflated);
+    put_chunk(out, "IEND", {});
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write((const char*) out.data(), out.size());
+}
+
+// child process
+
+static void report(int fd, const std::string& line) {
+    std::string text = line + "\n";
+    if (write(fd, text.data(), text.size()) < 0) {
+        _exit(1);
+    }
+}
+
+static void run_case(const RegressCase& test, const std::string& dump_dir, int out) {
+    NES nes(test.rom.c_str());
+    nes.set_present(false);
+    nes.set_keep_frame(true);
+    nes.set_render_mode(test.render_mode);
+
+    for (size_t i = 0; i < test.steps.size(); i++) {
+        const RegressStep& step = test.steps[i];
+
+        if (step.frame > nes.get_frame_count()) {
+            nes.run_frames(step.frame - nes.get_frame_count());
+        }
+        if (!nes.is_running()) {
+            report(out, "error cpu stopped before frame " + std::to_string(step.frame));
+            return;
+        }
+
+        switch (step.action) {
+            case REGRESS_PRESS: {
+                nes.set_button(step.button, true);
+                break;
+            }
+            case REGRESS_RELEASE: {
+                nes.set_button(step.button, false);
+                break;
+            }
+            case REGRESS_CHECK: {
+                uint64_t hash = nes.get_frame_hash();
+                report(out, "hash " + std::to_string(i) + " " + to_hex64(hash));
+
+                if (step.known && hash != step.hash && !dump_dir.empty()) {
+                    std::string base = test.name.substr(test.name.find_last_of('/') + 1);
+                    if (test.render_mode == RENDER_SCANLINE) {
+                        base += "-scanline";
+                    }
+                    write_png(dump_dir + "/" + base + "-" + std::to_string(step.frame) + ".png", nes.get_kept_frame(), WIDTH, HEIGHT);
+                }
+                break;
+            }
+        }
+    }
+}
+
+static pid_t start_case(const RegressCase& test, const std::string& dump_dir, int& fd) {
+    int pipes[2];
+    if (pipe(pipes) < 0) {
+        throw std::runtime_error("could not make pipe");
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw std::runtime_error("could not fork");
+    }
+
+    if (pid == 0) {
+        close(pipes[0]);
+
+        // the emulator talks a lot on stdout
+        int null = ::open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+
+        try {
+            run_case(test, dump_dir, pipes[1]);
+        } catch (std::exception& e) {
+            report(pipes[1], std::string("error ") + e.what());
+        }
+        close(pipes[1]);
+        _exit(0);
+    }
+
+    close(pipes[1]);
+    fd = pipes[0];
+    return pid;
+}
+
+// parent
+
+int regress(const char* manifest, const char* dump_dir, bool update) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(manifest);
+        if (!file) {
+            throw std::invalid_argument("could not open manifest");
+        }
+        for (std::string line; std::getline(file, line);) {
+            lines.push_back(line);
+        }
+    }
+
+    std::string path = manifest;
+    std::string base = path.find('/') == std::string::npos ? "" : path.substr(0, path.find_last_of('/') + 1);
+    std::vector<RegressCase> cases = read_manifest(lines, base);
+
+    // the scanline renderer has to match the dot one bit for bit, so every
+    // rom is checked under both against the same hashes
+    size_t roms = cases.size();
+    for (size_t i = 0; i < roms; i++) {
+        RegressCase scanline = cases[i];
+        scanline.render_mode = RENDER_SCANLINE;
+        cases.push_back(scanline);
+    }
+
+    std::string dumps = dump_dir ? dump_dir : "";
+    if (!dumps.empty()) {
+        mkdir(dumps.c_str(), 0755);
+    }
+
+    // nothing is shown, and children don't fight over the audio device
+    setenv("SDL_VIDEODRIVER", "dummy", 1);
+    setenv("SDL_AUDIODRIVER", "dummy", 1);
+
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::map<pid_t, std::pair<size_t, int>> running;
+    size_t next = 0;
+    int failed = 0;
+
+    // hashes seen while updating, by manifest line, both runs have to agree
+    std::map<size_t, std::string> recorded;
+
+    while (next < cases.size() || !running.empty()) {
+        while (running.size() < jobs && next < cases.size()) {
+            int fd;
+            pid_t pid = start_case(cases[next], dumps, fd);
+            running[pid] = {next, fd};
+            next++;
+        }
+
+        // results are a few lines, so they sit in the pipe until it's read
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0 || !running.count(pid)) {
+            continue;
+        }
+        RegressCase& test = cases[running[pid].first];
+        int fd = running[pid].second;
+        running.erase(pid);
+
+        std::string output;
+        char buffer[4096];
+        for (ssize_t count; (count = read(fd, buffer, sizeof(buffer))) > 0;) {
+            output.append(buffer, count);
+        }
+        close(fd);
+
+        std::vector<std::string> problems;
+        size_t checks = 0;
+        std::istringstream stream(output);
+        for (std::string line; std::getline(stream, line);) {
+            if (line.compare(0, 6, "error ") == 0) {
+                problems.push_back(line.substr(6));
+                continue;
+            }
+
+            size_t index;
+            std::string hex;
+            std::istringstream fields(line.substr(5));
+            fields >> index >> hex;
+            RegressStep& step = test.steps[index];
+            uint64_t hash = std::stoull(hex, nullptr, 16);
+            checks++;
+
+            if (update) {
+                if (recorded.count(step.line) && recorded[step.line] != hex) {
+                    problems.push_back("frame " + std::to_string(step.frame) + " differs between renderers, " + recorded[step.line] + " and " + hex);
+                }
+                recorded[step.line] = hex;
+                lines[step.line] = "check " + std::to_string(step.frame) + " " + hex;
+            } else if (!step.known) {
+                problems.push_back("frame " + std::to_string(step.frame) + " has no golden hash, got " + hex);
+            } else if (hash != step.hash) {
+                problems.push_back("frame " + std::to_string(step.frame) + " expected " + to_hex64(step.hash) + " got " + hex);
+            }
+        }
+
+        if (!WIFEXITED(status)) {
+            problems.push_back("crashed");
+        }
+
+        if (problems.empty()) {
+            std::cout << "PASS " << case_label(test) << " (" << checks << " checks)" << std::endl;
+        } else {
+            failed++;
+            std::cout << "FAIL " << case_label(test) << std::endl;
+            for (const std::string& problem : problems) {
+                std::cout << "    " << problem << std::endl;
+            }
+        }
+    }
+
+    if (update) {
+        std::ofstream file(manifest);
+        for (const std::string& line : lines) {
+            file << line << "\n";
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << cases.size() - failed << "/" << cases.size() << " runs passed in " << elapsed.count() << "s" << std::endl;
+    return failed;
+}
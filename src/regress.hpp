@@ -0,0 +1,47 @@
+#ifndef regress_hpp
+#define regress_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Golden frame regression runs. A manifest lists ROMs, each with button
+// presses and releases at given frames and the frame hashes expected at
+// checkpoints. Every ROM runs headless twice, once with the dot renderer and
+// once with the scanline one, against the same hashes. Each run is a child
+// process of its own, as many at once as there are cores, and any frame that
+// doesn't match is written out as a PNG.
+//
+// Manifest lines, # starts a comment:
+//   rom <path>                 starts a ROM, relative to the manifest
+//   press <frame> <button>     after that many frames, buttons are
+//   release <frame> <button>   a, b, select, start, up, down, left, right
+//   check <frame> <hash>       16 hex digits, or - until it's been recorded
+
+#define REGRESS_PRESS       0
+#define REGRESS_RELEASE     1
+#define REGRESS_CHECK       2
+
+struct RegressStep {
+    uint64_t frame;
+    uint8_t action;
+    uint8_t button;
+    uint64_t hash;
+    bool known;
+    // manifest line, for errors and for writing hashes back
+    size_t line;
+};
+
+struct RegressCase {
+    std::string name;
+    std::string rom;
+    uint8_t render_mode;
+    std::vector<RegressStep> steps;
+};
+
+// returns how many ROMs failed, update writes the hashes seen back into the
+// manifest instead of comparing them
+int regress(const char* manifest, const char* dump_dir, bool update);
+
+#endif
@@ -1,58 +1,369 @@
 #include "rom.hpp"
+#include "mapper.hpp"
+#include "romdb.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#define READ16(p) ((p)[0] | ((p)[1] << 8))
+#define READ32(p) ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((uint32_t) (p)[3] << 24))
 
 ROM::ROM(const char* filename) {
-    std::ifstream* rom = new std::ifstream;
-    rom->open(filename, std::fstream::in | std::fstream::binary);
+    map_file(filename);
     
-    if (!rom->is_open()) {
+    try {
+        // archives are recognised by content, not by extension
+        if (READ16(image) == GZIP_MAGIC) {
+            open_gzip();
+        } else if (READ32(image) == ZIP_LOCAL_MAGIC) {
+            open_zip();
+        }
+        
+        read_header();
+        identify();
+        decode_chr();
+    } catch (...) {
+        unmap_file();
+        throw;
+    }
+}
+
+ROM::~ROM() {
+    unmap_file();
+}
+
+// registry
+
+// (device, inode, size, mtime), so a file that changes on disk is reloaded
+typedef std::tuple<dev_t, ino_t, off_t, time_t> FileKey;
+
+static std::mutex registry_lock;
+static std::map<FileKey, std::weak_ptr<ROM>> by_file;
+static std::map<std::array<uint8_t, SHA1_SIZE>, std::weak_ptr<ROM>> by_content;
+
+template <typename T>
+static void prune(std::map<T, std::weak_ptr<ROM>>& registry) {
+    for (auto it = registry.begin(); it != registry.end();) {
+        if (it->second.expired()) it = registry.erase(it);
+        else it++;
+    }
+}
+
+std::shared_ptr<ROM> ROM::open(const char* filename) {
+    struct stat info;
+    if (stat(filename, &info) < 0) {
         throw std::invalid_argument("invalid filename");
     }
+    FileKey key(info.st_dev, info.st_ino, info.st_size, info.st_mtime);
+    
+    {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        auto it = by_file.find(key);
+        if (it != by_file.end()) {
+            if (std::shared_ptr<ROM> rom = it->second.lock()) {
+                return rom;
+            }
+        }
+    }
+    
+    // loaded outside the lock, other instances keep starting meanwhile
+    std::shared_ptr<ROM> rom = std::make_shared<ROM>(filename);
+    
+    std::lock_guard<std::mutex> guard(registry_lock);
+    prune(by_file);
+    prune(by_content);
+    
+    // same content under another name (or a .zip of it) shares the first image.
+    // The header is part of the key, since it picks the mapper and mirroring
+    SHA1 sha1;
+    sha1.update(rom->image, rom->chr_rom + rom->chr_size - rom->image);
+    std::array<uint8_t, SHA1_SIZE> content = sha1.digest();
     
-    this->read_header(rom);
+    auto it = by_content.find(content);
+    if (it != by_content.end()) {
+        if (std::shared_ptr<ROM> existing = it->second.lock()) {
+            rom = existing;
+        }
+    }
     
-    rom->close();
-    delete rom;
+    by_content[content] = rom;
+    by_file[key] = rom;
+    return rom;
 }
 
-void ROM::read_header(std::ifstream* rom) {
-    for (int i = 0; i < INES_HEADER; i++) {
-        header[i] = rom->get();
+void ROM::unmap_file() {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+    }
+}
+
+void ROM::map_file(const char* filename) {
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        throw std::invalid_argument("invalid filename");
     }
     
-    if (header[0] != 'N' || header[1] != 'E' || header[2] != 'S') {
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size < INES_HEADER) {
+        close(fd);
         throw bad_rom();
     }
     
-    prg_size = (header[4] + ((header[9] & 0x0f) << 8)) * PRG;
-    chr_size = (header[5] + ((header[9] & 0xf0) << 4)) * CHR;
+    mapping_size = info.st_size;
+    mapping = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
     
-    has_trainer = (header[6] & 0xb) >> 2;
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw std::runtime_error("could not map rom");
+    }
     
-    if (has_trainer) {
-        for (int i = 0; i < TRAINER; i++) {
-            trainer[i] = rom->get();
+    // the cpu walks prg all over the place, so fault the file in up front
+    madvise(mapping, mapping_size, MADV_WILLNEED);
+    image = (const uint8_t*) mapping;
+    image_size = mapping_size;
+}
+
+void ROM::open_gzip() {
+    // zlib parses the gzip wrapper itself with window bits + 16
+    inflate_image(image, image_size, 16 + MAX_WBITS);
+}
+
+void ROM::open_zip() {
+    const uint8_t* end = image + image_size;
+    const uint8_t* entry = nullptr;
+    const uint8_t* p = image;
+    
+    // walk the local headers for the first .nes, else take the first entry
+    while (p + ZIP_LOCAL_HEADER <= end && READ32(p) == ZIP_LOCAL_MAGIC) {
+        uint16_t flags = READ16(p + 6);
+        uint32_t compressed = READ32(p + 18);
+        uint16_t name_length = READ16(p + 26);
+        uint16_t extra_length = READ16(p + 28);
+        
+        if (p + ZIP_LOCAL_HEADER + name_length > end) {
+            break;
+        }
+        
+        std::string name((const char*) p + ZIP_LOCAL_HEADER, name_length);
+        if (entry == nullptr) {
+            entry = p;
         }
+        
+        if (name.size() > 4) {
+            std::string ext = name.substr(name.size() - 4);
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            if (ext == ".nes") {
+                entry = p;
+                break;
+            }
+        }
+        
+        // sizes in a trailing data descriptor can't be skipped over
+        if (flags & 0x08) {
+            break;
+        }
+        p += ZIP_LOCAL_HEADER + name_length + extra_length + compressed;
+    }
+    
+    if (entry == nullptr) {
+        throw bad_rom();
+    }
+    
+    uint16_t method = READ16(entry + 8);
+    const uint8_t* data = entry + ZIP_LOCAL_HEADER + READ16(entry + 26) + READ16(entry + 28);
+    if (data > end) {
+        throw bad_rom();
+    }
+    
+    if (method == 0) {
+        // stored, so the image can still be used straight from the mapping
+        image = data;
+        image_size = end - data;
+    } else if (method == 8) {
+        inflate_image(data, end - data, -MAX_WBITS);
+    } else {
+        throw bad_rom();
+    }
+}
+
+void ROM::inflate_image(const uint8_t* data, size_t size, int window_bits) {
+    z_stream stream = {};
+    stream.next_in = (Bytef*) data;
+    stream.avail_in = size;
+    
+    if (inflateInit2(&stream, window_bits) != Z_OK) {
+        throw std::runtime_error("could not start inflate");
+    }
+    
+    // the header says how much to allocate, then inflate stops as soon as
+    // prg and chr are full instead of running to the end of the stream
+    uint64_t filled = 0;
+    uint64_t total = INES_HEADER;
+    bool sized = false;
+    int status = Z_OK;
+    
+    // a bad header or a failed allocation mustn't leak the inflate state
+    try {
+        buffer.resize(INES_HEADER);
+        
+        while (filled < total && status == Z_OK) {
+            stream.next_out = buffer.data() + filled;
+            stream.avail_out = total - filled;
+            status = inflate(&stream, Z_NO_FLUSH);
+            filled = total - stream.avail_out;
+            
+            if (!sized && filled == INES_HEADER) {
+                std::copy(buffer.begin(), buffer.end(), header.begin());
+                read_sizes();
+                total = INES_HEADER + (has_trainer ? TRAINER : 0) + prg_size + chr_size;
+                buffer.resize(total);
+                sized = true;
+            }
+        }
+    } catch (...) {
+        inflateEnd(&stream);
+        throw;
+    }
+    
+    inflateEnd(&stream);
+    
+    if (filled < total || (status != Z_OK && status != Z_STREAM_END)) {
+        throw bad_rom();
+    }
+    
+    // nothing points at the compressed file any more
+    unmap_file();
+    image = buffer.data();
+    image_size = buffer.size();
+}
+
+void ROM::read_header() {
+    std::copy(image, image + INES_HEADER, header.begin());
+    
+    read_sizes();
+    
+    bool nes2 = (header[7] & 0x0c) == 0x08;
+    
+    // a short file is rejected here instead of reading past the end later
+    uint64_t offset = INES_HEADER;
+    uint64_t expected = offset + (has_trainer ? TRAINER : 0) + prg_size + chr_size;
+    if (prg_size == 0 || image_size < expected) {
+        throw bad_rom();
+    }
+    
+    if (has_trainer) {
+        trainer = image + offset;
+        offset += TRAINER;
     }
     
-    prg_rom.reserve(prg_size);
-    for (int i = 0; i < prg_size; i++) {
-        prg_rom.push_back(rom->get());
+    prg_rom = image + offset;
+    offset += prg_size;
+    chr_rom = image + offset;
+    
+    mapper = (header[6] >> 4) | (header[7] & 0xf0);
+    if (nes2) {
+        mapper |= (header[8] & 0x0f) << 8;
+    } else if (header[12] || header[13] || header[14] || header[15]) {
+        // old dumps with junk ("DiskDude!") in bytes 7-15
+        mapper &= 0x0f;
+    }
+    
+    if (header[6] & 0x08) {
+        mirroring = MIRROR_FOUR;
+    } else {
+        mirroring = (header[6] & 0x01) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+    }
+    
+    if (nes2) {
+        uint8_t shift = header[10] & 0x0f;
+        prg_ram_size = shift ? (64 << shift) : 0;
+    } else {
+        // iNES 1.0 can't say "none", 0 means the usual 8 KB
+        prg_ram_size = (header[8] ? header[8] : 1) * 0x2000;
+    }
+}
+
+void ROM::read_sizes() {
+    if (header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1a) {
+        throw bad_rom();
     }
     
-    mapper = ((header[6] & 0x0f) >> 4) + (header[7] & 0x0f) + ((header[8] & 0xf) << 8);
+    // byte 9 only holds size bits in NES 2.0 headers
+    bool nes2 = (header[7] & 0x0c) == 0x08;
     
-    chr_rom.reserve(chr_size);
-    for (int i = 0; i < chr_size; i++) {
-        chr_rom.push_back(rom->get());
+    prg_size = header[4] * PRG;
+    chr_size = header[5] * CHR;
+    if (nes2) {
+        prg_size += ((header[9] & 0x0f) << 8) * PRG;
+        chr_size += ((header[9] & 0xf0) << 4) * CHR;
     }
+    
+    has_trainer = (header[6] & 0x04) >> 2;
+}
+
+void ROM::decode_chr() {
+    chr_rows.resize(CHR_ROWS(chr_size));
+    chr_rows_flipped.resize(CHR_ROWS(chr_size));
+    chr_decode(chr_rom, chr_size, chr_rows.data(), chr_rows_flipped.data());
+}
+
+void ROM::identify() {
+    // prg and chr sit next to each other in the image
+    size_t size = prg_size + chr_size;
+    
+    identity.crc32 = crc32_ieee(prg_rom, size);
+    
+    SHA1 sha1;
+    sha1.update(prg_rom, size);
+    identity.sha1 = sha1.digest();
+    
+    const RomDBEntry* entry = romdb_lookup(identity.crc32);
+    identity.known = entry != nullptr;
+    
+    if (!entry) {
+        return;
+    }
+    
+    // four-screen VRAM is on the board, the database can't take it away
+    uint8_t corrected_mirroring = mirroring == MIRROR_FOUR ? mirroring : entry->mirroring;
+    uint32_t corrected_prg_ram = entry->prg_ram * 0x400;
+    
+    if (entry->mapper != mapper) {
+        std::cout << "Header corrected from database: mapper " << mapper << " -> " << entry->mapper << std::endl;
+    }
+    if (corrected_mirroring != mirroring) {
+        std::cout << "Header corrected from database: mirroring " << unsigned(mirroring) << " -> " << unsigned(corrected_mirroring) << std::endl;
+    }
+    if (corrected_prg_ram != prg_ram_size) {
+        std::cout << "Header corrected from database: prg ram " << prg_ram_size << " -> " << corrected_prg_ram << std::endl;
+    }
+    
+    mapper = entry->mapper;
+    mirroring = corrected_mirroring;
+    prg_ram_size = corrected_prg_ram;
 }
 
 uint8_t ROM::get_prg(uint64_t index) {
-    return prg_rom.at(index);
+    if (index >= prg_size) {
+        throw std::out_of_range("prg index out of range");
+    }
+    return prg_rom[index];
 }    
 
 uint8_t ROM::get_chr(uint64_t index) {
-    return chr_rom.at(index);
+    if (index >= chr_size) {
+        throw std::out_of_range("chr index out of range");
+    }
+    return chr_rom[index];
 }
 
 uint32_t ROM::get_prg_size() {
@@ -65,4 +376,32 @@ uint32_t ROM::get_chr_size() {
 
 uint32_t ROM::get_mapper() {
     return mapper;
+}
+
+uint8_t ROM::get_mirroring() {
+    return mirroring;
+}
+
+const uint8_t* ROM::get_prg_data() {
+    return prg_rom;
+}
+
+const uint8_t* ROM::get_chr_data() {
+    return chr_rom;
+}
+
+const uint16_t* ROM::get_chr_rows() {
+    return chr_rows.data();
+}
+
+const uint16_t* ROM::get_chr_rows_flipped() {
+    return chr_rows_flipped.data();
+}
+
+uint32_t ROM::get_prg_ram_size() {
+    return prg_ram_size;
+}
+
+const RomIdentity& ROM::get_identity() const {
+    return identity;
 }
\ No newline at end of file
@@ -4,39 +4,100 @@
 #include <cstdint>
 #include <vector>
 #include <array>
+#include <memory>
 
 #include <fstream>
 #include <iostream>
 #include <vector>
 #include <iterator>
+#include <string>
+#include <algorithm>
 
 #include <exception>
+#include <stdexcept>
+
+#include "hash.hpp"
+#include "chr.hpp"
 
 #define INES_HEADER 16
 #define PRG 16384
 #define CHR 8192
 #define TRAINER 512
 
+#define GZIP_MAGIC          0x8b1f
+#define ZIP_LOCAL_MAGIC     0x04034b50
+#define ZIP_LOCAL_HEADER    30
+
+// hashes of PRG + CHR, without the header
+struct RomIdentity {
+    uint32_t crc32;
+    std::array<uint8_t, SHA1_SIZE> sha1;
+    bool known;
+};
+
 class ROM {
 private:
-    std::vector<uint8_t> prg_rom;
-    std::vector<uint8_t> chr_rom;
+    // the .nes image; prg/chr point into it. It is either the file mapped
+    // read-only, or the buffer it was decompressed into
+    const uint8_t* image = nullptr;
+    size_t image_size = 0;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    std::vector<uint8_t> buffer;
+    
+    const uint8_t* prg_rom = nullptr;
+    const uint8_t* chr_rom = nullptr;
     std::array<uint8_t, INES_HEADER> header;
     uint32_t prg_size;
     uint32_t chr_size;
     uint32_t mapper;
+    uint8_t mirroring;
+    uint32_t prg_ram_size;
     
     bool has_trainer;
-    std::array<uint8_t, TRAINER> trainer;
-    void read_header(std::ifstream* rom);
+    const uint8_t* trainer = nullptr;
+    
+    RomIdentity identity;
+    
+    // chr pre-decoded to chunky rows, shared like the rest of the image
+    std::vector<uint16_t> chr_rows;
+    std::vector<uint16_t> chr_rows_flipped;
+    
+    void map_file(const char* filename);
+    void unmap_file();
+    void read_header();
+    void read_sizes();
+    
+    // archives
+    void open_gzip();
+    void open_zip();
+    void inflate_image(const uint8_t* data, size_t size, int window_bits);
+    void identify();
+    void decode_chr();
     
 public:
     ROM(const char* filename);
+    ~ROM();
+    
+    // Shared, read-only images: every instance opening the same file or the
+    // same content gets the same ROM for as long as one of them holds it.
+    static std::shared_ptr<ROM> open(const char* filename);
+    
+    ROM(const ROM&) = delete;
+    ROM& operator=(const ROM&) = delete;
+    
     uint8_t get_prg(uint64_t index);
     uint8_t get_chr(uint64_t index);
     uint32_t get_prg_size();
     uint32_t get_chr_size();
     uint32_t get_mapper();
+    uint8_t get_mirroring();
+    uint32_t get_prg_ram_size();
+    const RomIdentity& get_identity() const;
+    const uint8_t* get_prg_data();
+    const uint8_t* get_chr_data();
+    const uint16_t* get_chr_rows();
+    const uint16_t* get_chr_rows_flipped();
 };
 
 struct bad_rom : public std::exception {
@@ -45,4 +106,4 @@ struct bad_rom : public std::exception {
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,32 @@
+#include "romdb.hpp"
+#include "mapper.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+// the bundled corpus, add entries in crc order
+static const RomDBEntry romdb[] = {
+    // crc32     mapper         mirroring           prg_ram
+    {0x158b0388, MAPPER_NROM,   MIRROR_HORIZONTAL,  0},    // nestest
+    {0x371c9236, MAPPER_NROM,   MIRROR_HORIZONTAL,  0},    // color_test
+    {0x6f97c721, MAPPER_NROM,   MIRROR_HORIZONTAL,  0},    // dk
+    {0x8e2bd25c, MAPPER_NROM,   MIRROR_VERTICAL,    0},    // smb
+    {0xaa597c9a, MAPPER_MMC1,   MIRROR_VERTICAL,    8},    // cpu_interrupts
+    {0xc915a79f, MAPPER_NROM,   MIRROR_HORIZONTAL,  0},    // full_palette
+    {0xd4d9e21a, MAPPER_NROM,   MIRROR_VERTICAL,    0},    // tennis
+    {0xda59b973, MAPPER_MMC1,   MIRROR_VERTICAL,    8},    // official_only
+    {0xe0361415, MAPPER_MMC1,   MIRROR_VERTICAL,    8},    // tetris, "DiskDude!" header
+    {0xeea20263, MAPPER_MMC1,   MIRROR_VERTICAL,    8},    // ppu_vbl_nmi
+    {0xfac9c9e6, MAPPER_CNROM,  MIRROR_VERTICAL,    8},    // cpu_dummy_reads, results at $6000
+};
+
+const RomDBEntry* romdb_lookup(uint32_t crc32) {
+    const RomDBEntry* end = std::end(romdb);
+    const RomDBEntry* entry = std::lower_bound(std::begin(romdb), end, crc32,
+        [](const RomDBEntry& e, uint32_t crc) { return e.crc32 < crc; });
+
+    if (entry == end || entry->crc32 != crc32) {
+        return nullptr;
+    }
+    return entry;
+}
@@ -0,0 +1,17 @@
+#ifndef romdb_hpp
+#define romdb_hpp
+
+#include <cstdint>
+
+// Known-good board settings keyed by the CRC-32 of PRG + CHR (no header).
+// Kept sorted by crc so lookups are a binary search.
+struct RomDBEntry {
+    uint32_t crc32;
+    uint16_t mapper;
+    uint8_t mirroring;
+    uint8_t prg_ram;        // in KB
+};
+
+const RomDBEntry* romdb_lookup(uint32_t crc32);
+
+#endif
@@ -0,0 +1,214 @@
+#include "synth.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if !defined(SYNTH_SCALAR) && defined(__AVX2__)
+#define SYNTH_AVX2
+#include <immintrin.h>
+#elif !defined(SYNTH_SCALAR) && defined(__SSE2__)
+#define SYNTH_SSE2
+#include <emmintrin.h>
+#endif
+
+// sequences short enough to lay out whole and copy
+#define SYNTH_TILE          256
+
+// the shift register repeats after this many steps, from any state
+#define LFSR_PERIOD         32767
+#define LFSR_SHORT_PERIOD   93
+#define LFSR_BITS           15
+
+void synth_mix_tables(int volume, int16_t* pulse_table, int16_t* tnd_table) {
+    pulse_table[0] = 0;
+    for (int i = 1; i < PULSE_MIX_ENTRIES; i++) {
+        pulse_table[i] = (int16_t) (volume * 95.52 / (8128.0 / i + 100));
+    }
+
+    tnd_table[0] = 0;
+    for (int i = 1; i < TND_MIX_ENTRIES; i++) {
+        tnd_table[i] = (int16_t) (volume * 163.67 / (24329.0 / i + 100));
+    }
+}
+
+void synth_sequence(uint8_t* out, size_t count, const uint8_t* levels, uint8_t mask, uint8_t position, uint64_t until_step, uint64_t interval) {
+    size_t i = std::min<uint64_t>(until_step, count);
+    std::memset(out, levels[position], i);
+
+    size_t period = interval * (mask + 1);
+    if (period <= SYNTH_TILE && i + period < count) {
+        // one whole period as runs, then copies of it
+        for (size_t j = i; j < i + period; j += interval) {
+            position = (position + 1) & mask;
+            std::memset(out + j, levels[position], interval);
+        }
+        for (size_t j = i + period; j < count; j += period) {
+            std::memcpy(out + j, out + i, std::min(period, count - j));
+        }
+        return;
+    }
+
+    while (i < count) {
+        position = (position + 1) & mask;
+        size_t run = std::min<uint64_t>(interval, count - i);
+        std::memset(out + i, levels[position], run);
+        i += run;
+    }
+}
+
+void synth_noise(uint8_t* out, size_t count, uint8_t volume, uint16_t shift_register, bool short_mode, uint64_t until_step, uint64_t interval) {
+    const uint8_t levels[2] = {volume, 0};
+
+    size_t i = std::min<uint64_t>(until_step, count);
+    std::memset(out, levels[shift_register & 1], i);
+
+    while (i < count) {
+        shift_register = lfsr_step(shift_register, short_mode);
+        size_t run = std::min<uint64_t>(interval, count - i);
+        std::memset(out + i, levels[shift_register & 1], run);
+        i += run;
+    }
+}
+
+uint16_t lfsr_step(uint16_t shift_register, bool short_mode) {
+    uint16_t feedback = (shift_register ^ (shift_register >> (short_mode ? 6 : 1))) & 1;
+    return (shift_register >> 1) | (feedback << 14);
+}
+
+// the register is linear over GF(2), so a step is a 15x15 bit matrix, kept as
+// the image of each bit; jumps[mode][k] is 2^k steps
+typedef std::array<std::array<std::array<uint16_t, LFSR_BITS>, LFSR_BITS>, 2> LfsrJumps;
+
+static uint16_t apply_jump(const std::array<uint16_t, LFSR_BITS>& jump, uint16_t shift_register) {
+    uint16_t result = 0;
+    for (int bit = 0; bit < LFSR_BITS; bit++) {
+        if ((shift_register >> bit) & 1) {
+            result ^= jump[bit];
+        }
+    }
+    return result;
+}
+
+static LfsrJumps make_lfsr_jumps() {
+    LfsrJumps jumps;
+    for (int mode = 0; mode < 2; mode++) {
+        for (int bit = 0; bit < LFSR_BITS; bit++) {
+            jumps[mode][0][bit] = lfsr_step(1 << bit, mode == 1);
+        }
+        for (int k = 1; k < LFSR_BITS; k++) {
+            for (int bit = 0; bit < LFSR_BITS; bit++) {
+                jumps[mode][k][bit] = apply_jump(jumps[mode][k - 1], jumps[mode][k - 1][bit]);
+            }
+        }
+    }
+    return jumps;
+}
+
+static const LfsrJumps lfsr_jumps = make_lfsr_jumps();
+
+uint16_t lfsr_jump(uint16_t shift_register, bool short_mode, uint64_t steps) {
+    steps %= short_mode ? LFSR_SHORT_PERIOD : LFSR_PERIOD;
+    for (int k = 0; steps != 0; k++, steps >>= 1) {
+        if (steps & 1) {
+            shift_register = apply_jump(lfsr_jumps[short_mode][k], shift_register);
+        }
+    }
+    return shift_register;
+}
+
+void synth_mix(const uint8_t* pulse1, const uint8_t* pulse2, const uint8_t* triangle, const uint8_t* noise, const uint8_t* dmc,
+               const int16_t* pulse_table, const int16_t* tnd_table, int16_t* out, size_t count) {
+    size_t i = 0;
+
+#if defined(SYNTH_AVX2)
+    // indices in 32 bit lanes, then gathered; each gather reads the entry and
+    // the one after it, which is the spare entry at the end
+    for (; i + 8 <= count; i += 8) {
+        __m256i p1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (pulse1 + i)));
+        __m256i p2 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (pulse2 + i)));
+        __m256i t = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (triangle + i)));
+        __m256i n = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (noise + i)));
+        __m256i d = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (dmc + i)));
+
+        __m256i pulse_index = _mm256_add_epi32(p1, p2);
+        __m256i tnd_index = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(t, t), t), _mm256_add_epi32(_mm256_add_epi32(n, n), d));
+
+        __m256i pulse = _mm256_i32gather_epi32((const int*) pulse_table, pulse_index, 2);
+        __m256i tnd = _mm256_i32gather_epi32((const int*) tnd_table, tnd_index, 2);
+        pulse = _mm256_srai_epi32(_mm256_slli_epi32(pulse, 16), 16);
+        tnd = _mm256_srai_epi32(_mm256_slli_epi32(tnd, 16), 16);
+
+        __m256i sum = _mm256_add_epi32(pulse, tnd);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        _mm_storeu_si128((__m128i*) (out + i), packed);
+    }
+#elif defined(SYNTH_SSE2)
+    // no gathers, so indices 16 at a time and scalar lookups
+    const __m128i zero = _mm_setzero_si128();
+    alignas(16) uint16_t pulse_index[16];
+    alignas(16) uint16_t tnd_index[16];
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i p = _mm_add_epi8(_mm_loadu_si128((const __m128i*) (pulse1 + i)), _mm_loadu_si128((const __m128i*) (pulse2 + i)));
+        __m128i t = _mm_loadu_si128((const __m128i*) (triangle + i));
+        __m128i n = _mm_loadu_si128((const __m128i*) (noise + i));
+        __m128i d = _mm_loadu_si128((const __m128i*) (dmc + i));
+
+        for (int half = 0; half < 2; half++) {
+            __m128i t16 = half ? _mm_unpackhi_epi8(t, zero) : _mm_unpacklo_epi8(t, zero);
+            __m128i n16 = half ? _mm_unpackhi_epi8(n, zero) : _mm_unpacklo_epi8(n, zero);
+            __m128i d16 = half ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero);
+            __m128i p16 = half ? _mm_unpackhi_epi8(p, zero) : _mm_unpacklo_epi8(p, zero);
+            __m128i tnd = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(t16, t16), t16), _mm_add_epi16(_mm_add_epi16(n16, n16), d16));
+            _mm_store_si128((__m128i*) (pulse_index + half * 8), p16);
+            _mm_store_si128((__m128i*) (tnd_index + half * 8), tnd);
+        }
+
+        for (int k = 0; k < 16; k++) {
+            out[i + k] = pulse_table[pulse_index[k]] + tnd_table[tnd_index[k]];
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        out[i] = pulse_table[pulse1[i] + pulse2[i]] + tnd_table[3 * triangle[i] + 2 * noise[i] + dmc[i]];
+    }
+}
+
+size_t synth_changes(const int16_t* samples, size_t count, int16_t previous, uint16_t* positions) {
+    size_t found = 0;
+    if (count == 0) {
+        return 0;
+    }
+    if (samples[0] != previous) {
+        positions[found++] = 0;
+    }
+
+    size_t i = 1;
+
+#if defined(SYNTH_AVX2) || defined(SYNTH_SSE2)
+    // each sample against the one before, eight at a time; runs of the same
+    // level are the common case and cost one compare
+    for (; i + 8 <= count; i += 8) {
+        __m128i current = _mm_loadu_si128((const __m128i*) (samples + i));
+        __m128i before = _mm_loadu_si128((const __m128i*) (samples + i - 1));
+        int same = _mm_movemask_epi8(_mm_cmpeq_epi16(current, before));
+        if (same == 0xffff) {
+            continue;
+        }
+        for (int k = 0; k < 8; k++) {
+            if (!((same >> (k * 2)) & 1)) {
+                positions[found++] = i + k;
+            }
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        if (samples[i] != samples[i - 1]) {
+            positions[found++] = i;
+        }
+    }
+    return found;
+}
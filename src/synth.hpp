@@ -0,0 +1,46 @@
+#ifndef synth_hpp
+#define synth_hpp
+
+#include <cstdint>
+#include <cstddef>
+
+// Block synthesis for the APU. When the APU catches up over a long stretch
+// with no register writes in it, busy channels are rendered a cycle at a time
+// into byte arrays of levels and mixed through lookup tables, rather than
+// stepped one output change at a time.
+//
+// Built for AVX2 or SSE2 when the compiler targets them, scalar otherwise.
+// SYNTH_SCALAR forces the scalar version.
+
+// cycles rendered per call
+#define SYNTH_CHUNK         1024
+
+// pulse 1 + pulse 2, and 3 * triangle + 2 * noise + dmc
+#define PULSE_MIX_ENTRIES   31
+#define TND_MIX_ENTRIES     203
+
+// the nonlinear DAC, full scale at volume
+void synth_mix_tables(int volume, int16_t* pulse_table, int16_t* tnd_table);
+
+// a stepped sequence (pulse duty, triangle): levels[position] for until_step
+// cycles, then the next entry every interval cycles, wrapping at mask + 1
+void synth_sequence(uint8_t* out, size_t count, const uint8_t* levels, uint8_t mask, uint8_t position, uint64_t until_step, uint64_t interval);
+
+// noise, volume while bit 0 of the shift register is clear
+void synth_noise(uint8_t* out, size_t count, uint8_t volume, uint16_t shift_register, bool short_mode, uint64_t until_step, uint64_t interval);
+
+// the noise shift register one step on, or any number of steps on in at
+// most 15 table lookups
+uint16_t lfsr_step(uint16_t shift_register, bool short_mode);
+uint16_t lfsr_jump(uint16_t shift_register, bool short_mode, uint64_t steps);
+
+// per cycle levels to output, pulse_table[pulse1 + pulse2] + tnd_table[...];
+// both tables need one spare entry on the end
+void synth_mix(const uint8_t* pulse1, const uint8_t* pulse2, const uint8_t* triangle, const uint8_t* noise, const uint8_t* dmc,
+               const int16_t* pulse_table, const int16_t* tnd_table, int16_t* out, size_t count);
+
+// where out differs from the sample before it, previous being the one before
+// out[0]; returns how many positions were written
+size_t synth_changes(const int16_t* samples, size_t count, int16_t previous, uint16_t* positions);
+
+#endif